@@ -0,0 +1,13 @@
+make
+if [ ! -e text8 ]; then
+  wget http://mattmahoney.net/dc/text8.zip -O text8.gz
+  gzip -d text8.gz -f
+fi
+echo -----------------------------------------------------------------------------------------------------
+echo Skip-gram with per-pair negatives vs. -batch-neg 1 \(one set of negatives shared across each window\)
+echo Compare the training times and the accuracies printed below
+echo -----------------------------------------------------------------------------------------------------
+time ./word2vec -train text8 -output vectors-sg.bin -cbow 0 -size 200 -window 10 -negative 25 -hs 0 -sample 1e-4 -threads 20 -binary 1 -iter 15
+./compute-accuracy vectors-sg.bin 30000 < questions-words.txt
+time ./word2vec -train text8 -output vectors-sg-batch.bin -cbow 0 -size 200 -window 10 -negative 25 -hs 0 -sample 1e-4 -threads 20 -binary 1 -iter 15 -batch-neg 1
+./compute-accuracy vectors-sg-batch.bin 30000 < questions-words.txt
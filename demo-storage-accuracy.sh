@@ -0,0 +1,15 @@
+make
+if [ ! -e text8 ]; then
+  wget http://mattmahoney.net/dc/text8.zip -O text8.gz
+  gzip -d text8.gz -f
+fi
+echo -----------------------------------------------------------------------------------------------------
+echo fp32 weights vs. -storage bf16 / fp16 \(16-bit syn0 and syn1neg, fp32 arithmetic and output\)
+echo Compare the accuracies printed below
+echo -----------------------------------------------------------------------------------------------------
+for storage in fp32 bf16 fp16; do
+  time ./word2vec -train text8 -output vectors-$storage.bin -cbow 1 -size 200 -window 8 -negative 25 -hs 0 -sample 1e-4 -threads 20 -binary 1 -iter 15 -storage $storage
+  ./compute-accuracy vectors-$storage.bin 30000 < questions-words.txt
+done
+time ./word2vec -train text8 -output vectors-bf16-sr.bin -cbow 1 -size 200 -window 8 -negative 25 -hs 0 -sample 1e-4 -threads 20 -binary 1 -iter 15 -storage bf16 -stochastic-round 1
+./compute-accuracy vectors-bf16-sr.bin 30000 < questions-words.txt
@@ -0,0 +1,455 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Microbenchmarks for the building blocks of word2vec
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "w2v-tokenizer.h"
+#include "w2v-kernels.h"
+#include "w2v-sampler.h"
+
+#define MAX_STRING 100
+#define EXP_TABLE_SIZE 512  // As in word2vec.c
+#define MAX_EXP 6
+#define BENCH_ROWS 65536
+#define BENCH_UPDATES 2000000
+#define BENCH_TARGETS 6  // Output rows per position: the word and 5 negatives
+#define BENCH_DRAWS 50000000
+#define BENCH_SIGMOID_BOUND 1e-6
+
+double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The original stdio reader from word2vec.c, kept as the baseline
+void ReadWord(char *word, FILE *fin) {
+  int a = 0, ch;
+  while (!feof(fin)) {
+    ch = fgetc(fin);
+    if (ch == 13) continue;
+    if ((ch == ' ') || (ch == '\t') || (ch == '\n')) {
+      if (a > 0) {
+        if (ch == '\n') ungetc(ch, fin);
+        break;
+      }
+      if (ch == '\n') {
+        strcpy(word, (char *)"</s>");
+        return;
+      } else continue;
+    }
+    word[a] = ch;
+    a++;
+    if (a >= MAX_STRING - 1) a--;   // Truncate too long words
+  }
+  word[a] = 0;
+}
+
+// Tokenizes and hashes a whole file with ReadWord() and with the mapped tokenizer
+int BenchTokenizer(char *file_name) {
+  char word[MAX_STRING];
+  long long size, words = 0, tokens = 0;
+  unsigned long long check1 = 0, check2 = 0;
+  double t, t1, t2;
+  const char *data;
+  struct token_reader tr;
+  struct token tok;
+  FILE *fin = fopen(file_name, "rb");
+  if (fin == NULL) {
+    printf("Input file not found\n");
+    return 1;
+  }
+  t = Now();
+  while (1) {
+    ReadWord(word, fin);
+    if (feof(fin)) break;
+    check1 += HashWord(word, strlen(word));
+    words++;
+  }
+  t1 = Now() - t;
+  fclose(fin);
+
+  t = Now();
+  data = MapFile(file_name, &size);
+  if (data == NULL) return 1;
+  InitTokenReader(&tr, data, size, 0, MAX_STRING - 1);
+  while (ReadToken(&tr, &tok)) {
+    check2 += tok.hash;
+    tokens++;
+  }
+  UnmapFile(data, size);
+  t2 = Now() - t;
+
+  printf("%-12s %12s %10s %10s\n", "reader", "tokens", "seconds", "MB/s");
+  printf("%-12s %12lld %10.3f %10.1f\n", "ReadWord", words, t1, size / t1 / 1e6);
+  printf("%-12s %12lld %10.3f %10.1f\n", "ReadToken", tokens, t2, size / t2 / 1e6);
+  printf("Speedup: %.2fx%s\n", t1 / t2, (check1 == check2) ? "" : "  (token streams differ, see w2v-tokenizer.h)");
+  return 0;
+}
+
+// The sigmoid table word2vec.c used to have: table[i] = sigmoid(i * MAX_EXP / EXP_TABLE_SIZE) - 0.5
+float *InitSigmoidTable() {
+  float *table = (float *)malloc(EXP_TABLE_SIZE * sizeof(float));
+  int a;
+  for (a = 0; a < EXP_TABLE_SIZE; a++) {
+    table[a] = exp(a / (float)EXP_TABLE_SIZE * MAX_EXP);
+    table[a] = table[a] / (table[a] + 1) - 0.5;
+  }
+  return table;
+}
+
+static inline float TableSigmoid(const float *table, float f) {
+  float fa = (f < 0) ? -f : f, rv = 0.5;
+  if (fa < MAX_EXP) rv = table[(int)(fa * ((float)EXP_TABLE_SIZE / MAX_EXP))];
+  return (f > 0) ? (0.5 + rv) : (0.5 - rv);
+}
+
+// One negative-sampling step as word2vec.c used to do it: dot, table sigmoid, two axpys
+float UnfusedUpdate(const struct kernel_set *ks, const float *table, const int n, const float *x, float *row, float *err,
+                    float label, float alpha) {
+  float g = (label - TableSigmoid(table, ks->mac(n, x, row))) * alpha;
+  ks->mac1(n, err, g, row);
+  ks->mac1(n, row, g, x);
+  return g;
+}
+
+// The step fused per row: dot, sigmoid_grad and update one after the other while the row is in L1
+float FusedUpdate(const struct kernel_set *ks, const int n, const float *x, float *row, float *err, float label, float alpha) {
+  float g = ks->mac(n, x, row);
+  ks->sigmoid_grad(1, &g, &label, alpha);
+  ks->update(n, x, row, err, g);
+  return g;
+}
+
+// The step as UpdateOutputRows() in word2vec.c does it for a position: every dot product first,
+// one sigmoid_grad for all of them, then every update
+float BatchedUpdate(const struct kernel_set *ks, const int n, const float *x, float **rows, float *err,
+                    const float *labels, float alpha) {
+  float scores[BENCH_TARGETS];
+  int j;
+  for (j = 0; j < BENCH_TARGETS; j++) scores[j] = ks->mac(n, x, rows[j]);
+  ks->sigmoid_grad(BENCH_TARGETS, scores, labels, alpha);
+  for (j = 0; j < BENCH_TARGETS; j++) ks->update(n, x, rows[j], err, scores[j]);
+  return scores[0];
+}
+
+// Time per update of the negative-sampling step done in separate passes, fused per row and batched
+// per position, on random rows of a matrix much larger than the caches, like syn1neg during training.
+// Fusing saves the second and third read of the row, but each row then waits for its own dot
+// product; batching moves the same bytes and lets the misses of all rows of a position overlap.
+int BenchKernels() {
+  const int sizes[] = {100, 200, 300};
+  const float labels[BENCH_TARGETS] = {1, 0, 0, 0, 0, 0};
+  long long a, r;
+  unsigned long long next_random;
+  int s, j, k, n;
+  float *table, *x, *err, *rows, *targets[BENCH_TARGETS], check = 0;
+  double t, t1, t2, t3;
+  const struct kernel_set *ks;
+
+  table = InitSigmoidTable();
+  // Bytes are counted per update of an n-float row: the unfused step reads x and row for the
+  // dot product, err and row for the first axpy, row and x for the second, and writes err and row;
+  // update shares the row read of both axpys, fused or batched
+  printf("%-8s %5s %12s %12s %12s %14s %14s %8s\n", "kernels", "n", "unfused ns", "fused ns", "batched ns",
+         "bytes unfused", "bytes update", "speedup");
+  for (k = 0; k < (int)(sizeof(kernel_sets) / sizeof(kernel_sets[0])); k++) {
+    ks = &kernel_sets[k];
+    if (!ks->supported()) continue;
+    for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+      n = sizes[s];
+      x = (float *)malloc(n * sizeof(float));
+      err = (float *)calloc(n, sizeof(float));
+      rows = (float *)malloc((long long)BENCH_ROWS * n * sizeof(float));
+      for (a = 0; a < n; a++) x[a] = (a % 7 - 3) * 0.01;
+      for (a = 0; a < (long long)BENCH_ROWS * n; a++) rows[a] = (a % 11 - 5) * 0.001;
+      next_random = 1;
+      t = Now();
+      for (a = 0; a < BENCH_UPDATES; a++) {
+        next_random = next_random * (unsigned long long)25214903917 + 11;
+        r = (next_random >> 16) % BENCH_ROWS;
+        check += UnfusedUpdate(ks, table, n, x, rows + r * n, err, labels[a % BENCH_TARGETS], 0.001);
+      }
+      t1 = Now() - t;
+      next_random = 1;
+      t = Now();
+      for (a = 0; a < BENCH_UPDATES; a++) {
+        next_random = next_random * (unsigned long long)25214903917 + 11;
+        r = (next_random >> 16) % BENCH_ROWS;
+        check += FusedUpdate(ks, n, x, rows + r * n, err, labels[a % BENCH_TARGETS], 0.001);
+      }
+      t2 = Now() - t;
+      next_random = 1;
+      t = Now();
+      for (a = 0; a < BENCH_UPDATES; a += BENCH_TARGETS) {
+        for (j = 0; j < BENCH_TARGETS; j++) {
+          next_random = next_random * (unsigned long long)25214903917 + 11;
+          targets[j] = rows + (next_random >> 16) % BENCH_ROWS * n;
+        }
+        check += BatchedUpdate(ks, n, x, targets, err, labels, 0.001);
+      }
+      t3 = Now() - t;
+      printf("%-8s %5d %12.1f %12.1f %12.1f %14d %14d %7.2fx\n", ks->name, n, t1 / BENCH_UPDATES * 1e9,
+             t2 / BENCH_UPDATES * 1e9, t3 / BENCH_UPDATES * 1e9, (6 + 2) * n * 4, (5 + 2) * n * 4, t1 / t3);
+      free(rows);
+      free(err);
+      free(x);
+    }
+  }
+  if (check == 12345) printf("\n");  // Keeps the updates from being optimized away
+  free(table);
+  return 0;
+}
+
+// Largest distance of the table lookup and of every sigmoid_grad kernel from the exact sigmoid,
+// over a fine grid of (-MAX_EXP, MAX_EXP), and time per position to turn 1 + 5 negative scores into
+// gradients. Positions are independent, as in training: each call works on the next of many score
+// blocks, one cache line apart so that no masked load overlaps the store of the call before.
+// Fails if a kernel is further than BENCH_SIGMOID_BOUND from the exact value.
+int BenchSigmoid() {
+  const int points = 1 << 20, calls = 20000000, blocks = 4096;
+  int a, k, failed = 0;
+  float *table, *f, *g, *zero, *scores, *s, labels[6] = {1, 0, 0, 0, 0, 0}, check = 0;
+  double exact, err_table = 0, err, t, t_table;
+  const struct kernel_set *ks;
+
+  table = InitSigmoidTable();
+  f = (float *)malloc(points * sizeof(float));
+  g = (float *)malloc(points * sizeof(float));
+  zero = (float *)calloc(points, sizeof(float));
+  scores = (float *)malloc(blocks * 16 * sizeof(float));
+  for (a = 0; a < points; a++) f[a] = -MAX_EXP + 2.0 * MAX_EXP * (a + 0.5) / points;
+  for (a = 0; a < points; a++) {
+    exact = 1 / (1 + exp(-(double)f[a]));
+    if (fabs(TableSigmoid(table, f[a]) - exact) > err_table) err_table = fabs(TableSigmoid(table, f[a]) - exact);
+  }
+  for (a = 0; a < blocks * 16; a++) scores[a] = a % 11 - 5;
+  t = Now();
+  for (a = 0; a < calls; a++) {
+    s = scores + (a % blocks) * 16;
+    for (k = 0; k < 6; k++) s[k] = (labels[k] - TableSigmoid(table, s[k])) * -3;
+  }
+  t_table = Now() - t;
+  printf("%-8s %16s %14s\n", "sigmoid", "max abs error", "ns/position");
+  printf("%-8s %16.3g %14.2f\n", "table", err_table, t_table / calls * 1e9);
+  for (k = 0; k < (int)(sizeof(kernel_sets) / sizeof(kernel_sets[0])); k++) {
+    ks = &kernel_sets[k];
+    if (!ks->supported()) continue;
+    memcpy(g, f, points * sizeof(float));
+    for (a = 0; a < points; a += 16) ks->sigmoid_grad(16, g + a, zero + a, -1);
+    err = 0;
+    for (a = 0; a < points; a++) {
+      exact = 1 / (1 + exp(-(double)f[a]));
+      if (fabs(g[a] - exact) > err) err = fabs(g[a] - exact);
+    }
+    for (a = 0; a < blocks * 16; a++) scores[a] = a % 11 - 5;
+    t = Now();
+    for (a = 0; a < calls; a++) ks->sigmoid_grad(6, scores + (a % blocks) * 16, labels, -3);
+    t = Now() - t;
+    printf("%-8s %16.3g %14.2f%s\n", ks->name, err, t / calls * 1e9, (err > BENCH_SIGMOID_BOUND) ? "  FAILED" : "");
+    if (err > BENCH_SIGMOID_BOUND) failed = 1;
+  }
+  for (a = 0; a < blocks * 16; a++) check += scores[a];
+  if (check == 12345) printf("\n");  // Keeps the work from being optimized away
+  printf("Bound: %g\n", BENCH_SIGMOID_BOUND);
+  free(scores);
+  free(zero);
+  free(g);
+  free(f);
+  free(table);
+  return failed;
+}
+
+// One negative-sampling step of word2vec.c on rows drawn uniformly from a matrix of rows rows:
+// the 6 output rows of a position are prefetched distance steps ahead, then scored against x,
+// turned into gradients and updated. Returns seconds per step.
+double PrefetchSteps(const struct kernel_set *ks, float *matrix, long long rows, int distance, float *x, float *err) {
+  const int n = 100, k = 6, steps = 2000000;
+  long long a, d, c, ring[(16 + 1) * 6], *set;
+  unsigned long long next_random = 1;
+  float scores[16], labels[6] = {1, 0, 0, 0, 0, 0};
+  double t = Now();
+  for (a = 0; a < steps + distance; a++) {
+    // Draw the rows of step a, and prefetch them if they are not for this step
+    set = &ring[(a % (distance + 1)) * k];
+    for (d = 0; d < k; d++) {
+      next_random = next_random * (unsigned long long)25214903917 + 11;
+      set[d] = (next_random >> 16) % rows;
+      if (distance) for (c = 0; c < n; c += 16) __builtin_prefetch(&matrix[set[d] * n + c], 1, 3);
+    }
+    if (a < distance) continue;
+    set = &ring[((a - distance) % (distance + 1)) * k];
+    for (d = 0; d < k; d++) scores[d] = ks->mac(n, x, &matrix[set[d] * n]);
+    ks->sigmoid_grad(k, scores, labels, 0.001);
+    for (d = 0; d < k; d++) ks->update(n, x, &matrix[set[d] * n], err, scores[d]);
+  }
+  return (Now() - t) / steps;
+}
+
+// Time per negative-sampling step with output rows prefetched 0 (off) to 16 steps ahead, on a matrix
+// larger than the last level cache and on one that fits in L2. The difference from the L2 time is
+// the time the step spends stalled on memory.
+int BenchPrefetch(long long rows) {
+  const int distances[] = {0, 1, 2, 4, 8, 16}, n = 100;
+  long long a;
+  int d;
+  float *matrix, *x, *err;
+  double t_l2, t;
+  const struct kernel_set *ks = SelectKernels(NULL);
+
+  matrix = (float *)malloc(rows * n * sizeof(float));
+  x = (float *)malloc(n * sizeof(float));
+  err = (float *)calloc(n, sizeof(float));
+  if ((matrix == NULL) || (x == NULL) || (err == NULL)) {
+    printf("Memory allocation failed\n");
+    return 1;
+  }
+  for (a = 0; a < rows * n; a++) matrix[a] = (a % 11 - 5) * 0.001;
+  for (a = 0; a < n; a++) x[a] = (a % 7 - 3) * 0.01;
+  t_l2 = PrefetchSteps(ks, matrix, 2048, 0, x, err);
+  printf("Kernels: %s, %lld rows of %d floats (%lld MB)\n", ks->name, rows, n, rows * n * 4 >> 20);
+  printf("%-10s %12s %18s\n", "distance", "ns/step", "stalled ns/step");
+  printf("%-10s %12.1f %18s\n", "L2 only", t_l2 * 1e9, "-");
+  for (d = 0; d < (int)(sizeof(distances) / sizeof(distances[0])); d++) {
+    t = PrefetchSteps(ks, matrix, rows, distances[d], x, err);
+    printf("%-10d %12.1f %18.1f\n", distances[d], t * 1e9, (t - t_l2) * 1e9);
+  }
+  free(err);
+  free(x);
+  free(matrix);
+  return 0;
+}
+
+// Builds the unigram^0.75 distribution over the counts of a -save-vocab file two ways, the 2^27
+// entry table word2vec used to fill and the alias table, and compares draws from both with it
+int BenchSampler(char *vocab_file) {
+  const int table_size = 134217728;
+  char word[MAX_STRING];
+  long long a, i, size = 0, max_size = 1000, cn, *counts, *hist_table, *hist_alias, negs[5];
+  int *table;
+  unsigned long long next_random;
+  double t, t_init_table, t_init_alias, t_table, t_alias, d1, sum = 0, tv_table = 0, tv_alias = 0, p;
+  double max_rel_table = 0, max_rel_alias = 0, *weights;
+  struct alias_table alias;
+  FILE *fin = fopen(vocab_file, "rb");
+  if (fin == NULL) {
+    printf("Vocabulary file not found\n");
+    return 1;
+  }
+  counts = (long long *)malloc(max_size * sizeof(long long));
+  while (fscanf(fin, "%99s %lld", word, &cn) == 2) {
+    if (size == max_size) {
+      max_size *= 2;
+      counts = (long long *)realloc(counts, max_size * sizeof(long long));
+    }
+    counts[size++] = cn;
+  }
+  fclose(fin);
+  if (size < 2) {
+    printf("ERROR: vocabulary is empty\n");
+    return 1;
+  }
+  weights = (double *)malloc(size * sizeof(double));
+  for (a = 0; a < size; a++) sum += weights[a] = pow(counts[a], 0.75);
+
+  // InitUnigramTable() as it was
+  t = Now();
+  table = (int *)malloc(table_size * sizeof(int));
+  i = 0;
+  d1 = pow(counts[i], 0.75) / sum;
+  for (a = 0; a < table_size; a++) {
+    table[a] = i;
+    if (a / (double)table_size > d1) {
+      i++;
+      d1 += pow(counts[i], 0.75) / sum;
+    }
+    if (i >= size) i = size - 1;
+  }
+  t_init_table = Now() - t;
+  t = Now();
+  InitAliasTable(&alias, weights, size);
+  t_init_alias = Now() - t;
+
+  hist_table = (long long *)calloc(size, sizeof(long long));
+  hist_alias = (long long *)calloc(size, sizeof(long long));
+  next_random = 1;
+  t = Now();
+  for (a = 0; a < BENCH_DRAWS; a++) {
+    next_random = (next_random + 11) * (unsigned long long)25214903917;
+    hist_table[table[(next_random >> 16) % table_size]]++;
+  }
+  t_table = Now() - t;
+  next_random = 1;
+  t = Now();
+  for (a = 0; a < BENCH_DRAWS; a += 5) {
+    AliasDrawBatch(&alias, &next_random, 5, negs);
+    for (i = 0; i < 5; i++) hist_alias[negs[i]]++;
+  }
+  t_alias = Now() - t;
+
+  // Total variation distance from the exact distribution, and the worst relative error over
+  // words expected at least 100000 times
+  for (a = 0; a < size; a++) {
+    p = weights[a] / sum;
+    tv_table += fabs(hist_table[a] / (double)BENCH_DRAWS - p) / 2;
+    tv_alias += fabs(hist_alias[a] / (double)BENCH_DRAWS - p) / 2;
+    if (p * BENCH_DRAWS < 100000) continue;
+    if (fabs(hist_table[a] / (p * BENCH_DRAWS) - 1) > max_rel_table) max_rel_table = fabs(hist_table[a] / (p * BENCH_DRAWS) - 1);
+    if (fabs(hist_alias[a] / (p * BENCH_DRAWS) - 1) > max_rel_alias) max_rel_alias = fabs(hist_alias[a] / (p * BENCH_DRAWS) - 1);
+  }
+  printf("Vocabulary: %lld words, %d draws\n", size, BENCH_DRAWS);
+  printf("%-8s %12s %10s %10s %12s %12s\n", "sampler", "memory KB", "init s", "ns/draw", "TV distance", "max rel err");
+  printf("%-8s %12lld %10.3f %10.2f %12.5f %12.5f\n", "table", (long long)table_size * sizeof(int) / 1024, t_init_table,
+         t_table / BENCH_DRAWS * 1e9, tv_table, max_rel_table);
+  printf("%-8s %12lld %10.3f %10.2f %12.5f %12.5f\n", "alias", size * (long long)sizeof(struct alias_entry) / 1024, t_init_alias,
+         t_alias / BENCH_DRAWS * 1e9, tv_alias, max_rel_alias);
+  FreeAliasTable(&alias);
+  free(table);
+  free(hist_table);
+  free(hist_alias);
+  free(weights);
+  free(counts);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: ./w2v-bench <benchmark> [args]\n");
+    printf("Benchmarks:\n");
+    printf("\ttokenizer <file>\n");
+    printf("\t\tBytes/sec of ReadWord() vs. the mapped tokenizer over <file>\n");
+    printf("\tkernels\n");
+    printf("\t\tTime and bytes moved per negative-sampling update, separate passes vs. fused per row vs. batched\n");
+    printf("\tsigmoid\n");
+    printf("\t\tError of the sigmoid table and of the computed sigmoid_grad kernels, and their time per position\n");
+    printf("\tprefetch [rows]\n");
+    printf("\t\tNegative-sampling step time with output rows prefetched 0 to 16 steps ahead, on a [rows] x 100\n");
+    printf("\t\tmatrix (default 2621440 rows, 1 GB)\n");
+    printf("\tsampler <vocab file>\n");
+    printf("\t\tUnigram table vs. alias table: memory, setup time, draw time and distance from the exact distribution\n");
+    return 0;
+  }
+  if (!strcmp(argv[1], "tokenizer") && (argc > 2)) return BenchTokenizer(argv[2]);
+  if (!strcmp(argv[1], "kernels")) return BenchKernels();
+  if (!strcmp(argv[1], "sigmoid")) return BenchSigmoid();
+  if (!strcmp(argv[1], "prefetch")) return BenchPrefetch((argc > 2) ? atoll(argv[2]) : 2621440);
+  if (!strcmp(argv[1], "sampler") && (argc > 2)) return BenchSampler(argv[2]);
+  printf("Unknown benchmark or missing arguments: %s\n", argv[1]);
+  return 1;
+}
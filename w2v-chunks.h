@@ -0,0 +1,235 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Dynamic work distribution over the training data.
+//
+// The data is cut into many chunks that start and end on sentence boundaries, and every epoch
+// visits all of them in its own shuffled order. Threads take the next chunk of the whole run
+// with one atomic increment whenever they finish one, so a thread that is slowed down simply
+// takes fewer chunks, and the next epoch starts on a thread as soon as it runs out of work in
+// the current one. Only the last chunk of the run can leave threads idle.
+//
+// Chunks are finished out of order. Every chunk is held by whoever still has work from it -- the
+// thread reading it, and in pipeline mode every queued batch of its sentences -- and ChunksDone()
+// tells how far the run is complete without gaps. A checkpoint keeps that and, with
+// ChunksFinished(), the entries after it that are finished as well; ResumeChunkSchedule() skips
+// all of them and hands the gaps between them out again.
+//
+// The part of the schedule that changes can live in shared memory, for a run shared by several
+// processes. Each entry records who took it, so that ReturnChunks() can hand out the entries of a
+// process that died again.
+
+#ifndef W2V_CHUNKS_H
+#define W2V_CHUNKS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "w2v-shared.h"
+
+// The changing part of a schedule, followed by its per-entry arrays
+struct chunk_state {
+  long long next;        // Next entry of order to hand out
+  char pad0[64];
+  pthread_mutex_t lock;  // Guards num_retry, retry and owners
+  long long num_retry;   // Entries given back, handed out again before next
+  char pad1[64];
+};
+
+struct chunk_schedule {
+  long long num_chunks, epochs;
+  long long *bounds;  // Chunk i is [bounds[i], bounds[i + 1])
+  int *order;         // Chunks of epoch e in order: order[e * num_chunks ...]
+  struct chunk_state *state;
+  long long *retry;   // The entries given back
+  long long *words;   // Per entry of order: words read from it, set when its reading ends
+  int *holds;         // Per entry of order: work still out on it, 1 until it has been read
+  int *owners;        // Per entry of order: who took it last
+  long long done, done_words;  // Entries before done are all finished; the words they had
+  void *memory;       // The state, if it is not shared
+};
+
+// An entry finished out of order, as a checkpoint keeps it
+struct finished_chunk {
+  long long entry, words;
+};
+
+// Bytes of the state of a schedule with entries entries
+static inline long long ChunkStateSize(long long entries) {
+  return sizeof(struct chunk_state) + entries * (2 * sizeof(long long) + 2 * sizeof(int));
+}
+
+// Cuts [0, size) into num_chunks chunks whose boundaries align() moves to the next sentence start,
+// and shuffles their order for every one of epochs epochs. The order only depends on seed.
+// The state is kept in shared if that is not NULL, and only set up there if create is set;
+// otherwise it is allocated.
+static inline void InitChunkSchedule(struct chunk_schedule *s, long long size, long long num_chunks, long long epochs,
+                                     long long (*align)(long long pos), unsigned long long seed, void *shared, int create) {
+  long long a, e, j, entries;
+  int t, *order;
+  if (num_chunks < 1) num_chunks = 1;
+  entries = epochs * num_chunks;
+  s->num_chunks = num_chunks;
+  s->epochs = epochs;
+  s->done = s->done_words = 0;
+  s->memory = NULL;
+  if (shared == NULL) shared = s->memory = calloc(1, ChunkStateSize(entries));
+  s->bounds = (long long *)malloc((num_chunks + 1) * sizeof(long long));
+  s->order = (int *)malloc(entries * sizeof(int));
+  if ((shared == NULL) || (s->bounds == NULL) || (s->order == NULL)) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  s->state = (struct chunk_state *)shared;
+  s->retry = (long long *)(s->state + 1);
+  s->words = s->retry + entries;
+  s->holds = (int *)(s->words + entries);
+  s->owners = s->holds + entries;
+  if (create || (s->memory != NULL)) {
+    s->state->next = s->state->num_retry = 0;
+    InitSharedMutex(&s->state->lock);
+    for (a = 0; a < entries; a++) {
+      s->holds[a] = 1;
+      s->owners[a] = -1;
+    }
+  }
+  s->bounds[0] = 0;
+  for (a = 1; a < num_chunks; a++) {
+    s->bounds[a] = align(size / num_chunks * a);
+    if (s->bounds[a] < s->bounds[a - 1]) s->bounds[a] = s->bounds[a - 1];
+  }
+  s->bounds[num_chunks] = size;
+  for (e = 0; e < epochs; e++) {
+    order = &s->order[e * num_chunks];
+    for (a = 0; a < num_chunks; a++) order[a] = a;
+    for (a = num_chunks - 1; a > 0; a--) {  // Fisher-Yates
+      seed = seed * (unsigned long long)25214903917 + 11;
+      j = (seed >> 16) % (a + 1);
+      t = order[a];
+      order[a] = order[j];
+      order[j] = t;
+    }
+  }
+}
+
+static inline void FreeChunkSchedule(struct chunk_schedule *s) {
+  free(s->bounds);
+  free(s->order);
+  free(s->memory);
+}
+
+// Skips the first done entries, finished by an earlier run that had read words from them, and the
+// num_finished entries of finished after them; the entries in between are handed out first.
+// Returns the words of all the skipped entries.
+static inline long long ResumeChunkSchedule(struct chunk_schedule *s, long long done, long long words,
+                                            const struct finished_chunk *finished, long long num_finished) {
+  struct chunk_state *st = s->state;
+  long long a, k, next = done, total = words;
+  for (a = 0; a < done; a++) s->holds[a] = 0;
+  for (a = 0; a < num_finished; a++) {
+    k = finished[a].entry;
+    s->holds[k] = 0;
+    s->words[k] = finished[a].words;
+    total += finished[a].words;
+    if (k >= next) next = k + 1;
+  }
+  st->num_retry = 0;
+  for (k = next - 1; k >= done; k--) if (s->holds[k] != 0) s->retry[st->num_retry++] = k;  // Taken from the end
+  st->next = next;
+  s->done = done;
+  s->done_words = words;
+  return total;
+}
+
+// Hands out the next chunk to owner as [*begin, *end) and returns its entry in the run (the epoch
+// is entry / num_chunks), or -1 when there is none left. The caller holds the entry until
+// FinishChunk(). Every store leaves the state usable if the process dies holding the lock.
+static inline long long NextChunk(struct chunk_schedule *s, int owner, long long *begin, long long *end) {
+  struct chunk_state *st = s->state;
+  long long k = -1, c;
+  LockShared(&st->lock);
+  if (st->num_retry > 0) {
+    k = s->retry[st->num_retry - 1];
+    s->owners[k] = owner;
+    st->num_retry--;
+  } else if (st->next < s->epochs * s->num_chunks) {
+    k = st->next;
+    s->owners[k] = owner;
+    st->next++;
+  }
+  UnlockShared(&st->lock);
+  if (k < 0) return -1;
+  c = s->order[k];
+  *begin = s->bounds[c];
+  *end = s->bounds[c + 1];
+  return k;
+}
+
+// Takes one more hold on entry k, for work from it that is passed on
+static inline void HoldChunk(struct chunk_schedule *s, long long k) {
+  __atomic_add_fetch(&s->holds[k], 1, __ATOMIC_RELAXED);
+}
+
+// Gives up a hold on entry k once its work has been done, with all of its weight updates
+static inline void ReleaseChunk(struct chunk_schedule *s, long long k) {
+  __atomic_sub_fetch(&s->holds[k], 1, __ATOMIC_RELEASE);
+}
+
+// Records that reading entry k ended after words words and gives up the reader's hold
+static inline void FinishChunk(struct chunk_schedule *s, long long k, long long words) {
+  s->words[k] = words;
+  ReleaseChunk(s, k);
+}
+
+// Gives the unfinished entries of owner back, to be handed out again from their start, and returns
+// how many there were. For a process that died; call it from the one that calls ChunksDone().
+static inline long long ReturnChunks(struct chunk_schedule *s, int owner) {
+  struct chunk_state *st = s->state;
+  long long k, a, count = 0;
+  LockShared(&st->lock);
+  for (k = s->done; k < st->next; k++) {
+    if ((s->owners[k] != owner) || (__atomic_load_n(&s->holds[k], __ATOMIC_ACQUIRE) == 0)) continue;
+    for (a = 0; a < st->num_retry; a++) if (s->retry[a] == k) break;
+    if (a < st->num_retry) continue;  // Given back already, the owner died taking it again
+    s->holds[k] = 1;
+    s->retry[st->num_retry++] = k;
+    count++;
+  }
+  UnlockShared(&st->lock);
+  return count;
+}
+
+// Returns the number of leading entries that are finished, and their words in *words. Every
+// update from them has been made before this returns. Only one thread may call it.
+static inline long long ChunksDone(struct chunk_schedule *s, long long *words) {
+  while ((s->done < s->epochs * s->num_chunks) && (__atomic_load_n(&s->holds[s->done], __ATOMIC_ACQUIRE) == 0)) {
+    s->done_words += s->words[s->done++];
+  }
+  *words = s->done_words;
+  return s->done;
+}
+
+// Stores the entries after the leading ones of ChunksDone() that are finished too in finished,
+// which has room for every entry, and returns how many there are. Call it right after ChunksDone(),
+// from the same thread: every update from them has been made before this returns.
+static inline long long ChunksFinished(struct chunk_schedule *s, struct finished_chunk *finished) {
+  long long k, n = 0, next = __atomic_load_n(&s->state->next, __ATOMIC_RELAXED);
+  for (k = s->done; k < next; k++) {
+    if (__atomic_load_n(&s->holds[k], __ATOMIC_ACQUIRE) != 0) continue;
+    finished[n].entry = k;
+    finished[n++].words = s->words[k];
+  }
+  return n;
+}
+
+#endif
@@ -0,0 +1,217 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "w2v-encoded.h"
+#include "w2v-tokenizer.h"
+
+#define MAX_STRING 100
+
+struct vocab_word {
+  char *word;
+  long long cn;
+};
+
+char train_file[MAX_STRING], output_file[MAX_STRING], read_vocab_file[MAX_STRING];
+struct vocab_word *vocab;
+int debug_mode = 2, min_count = 5;
+struct word_hash vocab_hash;
+long long vocab_max_size = 1000, vocab_size = 0;
+
+// Reads a single word from a file, assuming space + tab + EOL to be word boundaries
+// Only used for the vocabulary file; the corpus goes through the same tokenizer as word2vec
+void ReadWord(char *word, FILE *fin) {
+  int a = 0, ch;
+  while (!feof(fin)) {
+    ch = fgetc(fin);
+    if (ch == 13) continue;
+    if ((ch == ' ') || (ch == '\t') || (ch == '\n')) {
+      if (a > 0) {
+        if (ch == '\n') ungetc(ch, fin);
+        break;
+      }
+      if (ch == '\n') {
+        strcpy(word, (char *)"</s>");
+        return;
+      } else continue;
+    }
+    word[a] = ch;
+    a++;
+    if (a >= MAX_STRING - 1) a--;   // Truncate too long words
+  }
+  word[a] = 0;
+}
+
+static int SameVocabWord(const void *ctx, int index, const char *word, int len) {
+  const char *w = vocab[index].word;
+  return !strncmp(word, w, len) && (w[len] == 0);
+}
+
+// Returns position of a token in the vocabulary; if the word is not found, returns -1
+int SearchToken(struct token *t) {
+  return WordHashFind(&vocab_hash, t->hash, t->word, t->len, SameVocabWord, NULL);
+}
+
+// Same ordering as VocabCompare() in word2vec.c: by count, ties broken by the word itself
+int VocabCompare(const void *a, const void *b) {
+  long long ca = ((struct vocab_word *)a)->cn, cb = ((struct vocab_word *)b)->cn;
+  if (ca != cb) return (cb > ca) ? 1 : -1;
+  return strcmp(((struct vocab_word *)a)->word, ((struct vocab_word *)b)->word);
+}
+
+// Loads the vocabulary the same way word2vec -read-vocab does, so that indices line up
+void ReadVocab() {
+  long long a, b, cn;
+  char c, word[MAX_STRING];
+  FILE *fin = fopen(read_vocab_file, "rb");
+  if (fin == NULL) {
+    printf("Vocabulary file not found\n");
+    exit(1);
+  }
+  vocab_size = 0;
+  while (1) {
+    ReadWord(word, fin);
+    if (feof(fin)) break;
+    if (vocab_size + 3 >= vocab_max_size) {
+      vocab_max_size += 1024;
+      vocab = (struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
+    }
+    vocab[vocab_size].word = strdup(word);
+    fscanf(fin, "%lld%c", &cn, &c);
+    vocab[vocab_size].cn = cn;
+    vocab_size++;
+  }
+  fclose(fin);
+  if (vocab_size == 0) {
+    printf("ERROR: vocabulary is empty\n");
+    exit(1);
+  }
+  // Sort the vocabulary and keep </s> at the first position, then drop rare words
+  qsort(&vocab[1], vocab_size - 1, sizeof(struct vocab_word), VocabCompare);
+  for (a = 0, b = 0; a < vocab_size; a++) {
+    if ((vocab[a].cn < min_count) && (a != 0)) {
+      free(vocab[a].word);
+      continue;
+    }
+    vocab[b++] = vocab[a];
+  }
+  vocab_size = b;
+  InitWordHash(&vocab_hash, vocab_size, NULL, NULL);
+  for (a = 0; a < vocab_size; a++) WordHashInsert(&vocab_hash, HashWord(vocab[a].word, strlen(vocab[a].word)), a);
+  if (debug_mode > 0) printf("Vocab size: %lld\n", vocab_size);
+}
+
+void EncodeCorpus() {
+  long long a, i, words = 0, oov = 0, size;
+  const char *data;
+  struct token_reader tr;
+  struct token tok;
+  struct encoded_header header;
+  FILE *fo;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ENCODED_MAGIC, sizeof(header.magic));
+  header.vocab_checksum = CHECKSUM_INIT;
+  for (a = 0; a < vocab_size; a++) header.vocab_checksum = VocabChecksum(header.vocab_checksum, vocab[a].word, vocab[a].cn);
+  header.vocab_size = vocab_size;
+
+  data = MapFile(train_file, &size);
+  if (data == NULL) {
+    printf("ERROR: training data file not found!\n");
+    exit(1);
+  }
+  fo = fopen(output_file, "wb");
+  if (fo == NULL) {
+    printf("ERROR: cannot open output file %s\n", output_file);
+    exit(1);
+  }
+  fwrite(&header, sizeof(header), 1, fo);
+  InitTokenReader(&tr, data, size, 0, MAX_STRING - 1);
+  while (ReadToken(&tr, &tok)) {
+    words++;
+    if ((debug_mode > 1) && (words % 100000 == 0)) {
+      printf("%lldK%c", words / 1000, 13);
+      fflush(stdout);
+    }
+    i = SearchToken(&tok);
+    if (i == -1) {
+      oov++;
+      continue;
+    }
+    WriteEncodedIndex(i, fo);
+    header.token_count++;
+  }
+  UnmapFile(data, size);
+  if (debug_mode > 0) {
+    printf("Words in train file: %lld\n", words);
+    printf("Encoded tokens: %lld (%lld out of vocabulary)\n", header.token_count, oov);
+    printf("Encoded size: %ld bytes\n", ftell(fo));
+  }
+  fseek(fo, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, fo);
+  fclose(fo);
+}
+
+int ArgPos(char *str, int argc, char **argv) {
+  int a;
+  for (a = 1; a < argc; a++) if (!strcmp(str, argv[a])) {
+    if (a == argc - 1) {
+      printf("Argument missing for %s\n", str);
+      exit(1);
+    }
+    return a;
+  }
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  int i;
+  if (argc == 1) {
+    printf("WORD2VEC corpus encoder\n\n");
+    printf("Options:\n");
+    printf("\t-train <file>\n");
+    printf("\t\tText data to encode\n");
+    printf("\t-read-vocab <file>\n");
+    printf("\t\tVocabulary to encode against, as written by word2vec -save-vocab\n");
+    printf("\t-output <file>\n");
+    printf("\t\tUse <file> to save the encoded corpus\n");
+    printf("\t-min-count <int>\n");
+    printf("\t\tMust match the -min-count used for training; default is 5\n");
+    printf("\t-debug <int>\n");
+    printf("\t\tSet the debug mode (default = 2 = more info during encoding)\n");
+    printf("\nExamples:\n");
+    printf("./word2vec -train data.txt -save-vocab vocab.txt\n");
+    printf("./w2v-encode -train data.txt -read-vocab vocab.txt -output data.enc\n");
+    printf("./word2vec -train-encoded data.enc -read-vocab vocab.txt -output vec.txt\n\n");
+    return 0;
+  }
+  train_file[0] = 0;
+  output_file[0] = 0;
+  read_vocab_file[0] = 0;
+  if ((i = ArgPos((char *)"-train", argc, argv)) > 0) strcpy(train_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-read-vocab", argc, argv)) > 0) strcpy(read_vocab_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-output", argc, argv)) > 0) strcpy(output_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-min-count", argc, argv)) > 0) min_count = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-debug", argc, argv)) > 0) debug_mode = atoi(argv[i + 1]);
+  if ((train_file[0] == 0) || (read_vocab_file[0] == 0) || (output_file[0] == 0)) {
+    printf("ERROR: -train, -read-vocab and -output are required\n");
+    return 1;
+  }
+  vocab = (struct vocab_word *)calloc(vocab_max_size, sizeof(struct vocab_word));
+  ReadVocab();
+  EncodeCorpus();
+  return 0;
+}
@@ -0,0 +1,95 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Pre-tokenized training corpus, as written by w2v-encode and read by word2vec -train-encoded.
+//
+// The file is a fixed header followed by one LEB128 varint per token: the vocabulary index of
+// the word, with 0 being the </s> sentence marker. Out-of-vocabulary words are dropped, exactly
+// like ReadWordIndex() + the training loop would drop them. As the vocabulary is sorted by
+// frequency, most tokens take one or two bytes. A varint always ends with a byte that has the
+// high bit clear, so a reader can start at any byte offset and resync on the next token.
+
+#ifndef W2V_ENCODED_H
+#define W2V_ENCODED_H
+
+#include <stdio.h>
+#include <string.h>
+
+#define ENCODED_MAGIC "W2VENC01"
+#define CHECKSUM_INIT 14695981039346656037ULL
+
+struct encoded_header {
+  char magic[8];
+  unsigned long long vocab_checksum;  // VocabChecksum() over the final (sorted, reduced) vocabulary
+  long long vocab_size;
+  long long token_count;              // Number of encoded tokens, sentence markers included
+};
+
+// FNV-1a over the word, its terminator and its count; call once per vocabulary entry, in order
+static inline unsigned long long VocabChecksum(unsigned long long hash, const char *word, long long count) {
+  int a;
+  do {
+    hash = (hash ^ (unsigned char)*word) * 1099511628211ULL;
+  } while (*word++);
+  for (a = 0; a < 8; a++) hash = (hash ^ ((count >> (a * 8)) & 0xff)) * 1099511628211ULL;
+  return hash;
+}
+
+static inline void WriteEncodedIndex(long long index, FILE *fo) {
+  while (index >= 0x80) {
+    putc_unlocked((index & 0x7f) | 0x80, fo);
+    index >>= 7;
+  }
+  putc_unlocked(index, fo);
+}
+
+// Decodes the token at *pos and advances *pos past it
+static inline long long ReadEncodedIndex(const unsigned char *data, long long *pos) {
+  long long index = 0;
+  int shift = 0;
+  unsigned char ch;
+  do {
+    ch = data[(*pos)++];
+    index |= (long long)(ch & 0x7f) << shift;
+    shift += 7;
+  } while (ch & 0x80);
+  return index;
+}
+
+// Counts the tokens of the size bytes at data, or returns -1 if one is cut off at the end or is not
+// an index below vocab_size. Once this passed, ReadEncodedIndex() needs no bounds checks.
+static inline long long CountEncoded(const unsigned char *data, long long size, long long vocab_size) {
+  long long pos = 0, index, count = 0;
+  int shift;
+  while (pos < size) {
+    index = 0;
+    shift = 0;
+    do {
+      if ((pos == size) || (shift > 56)) return -1;
+      index |= (long long)(data[pos] & 0x7f) << shift;
+      shift += 7;
+    } while (data[pos++] & 0x80);
+    if (index >= vocab_size) return -1;
+    count++;
+  }
+  return count;
+}
+
+// Returns the first token boundary at or after pos
+static inline long long SeekEncoded(const unsigned char *data, long long size, long long pos) {
+  while ((pos > 0) && (pos < size) && (data[pos - 1] & 0x80)) pos++;
+  return pos;
+}
+
+#endif
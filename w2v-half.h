@@ -0,0 +1,159 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// 16-bit storage for weight matrices: bfloat16 or IEEE half precision.
+//
+// Rows are converted to fp32 to be worked on and rounded back when written. bf16 keeps the fp32
+// exponent range with an 8-bit mantissa, so small updates to large weights can round away; with
+// stochastic rounding they are kept on average instead, at the cost of noise on every write.
+// fp16 has an 11-bit mantissa but a narrow range. Its conversions use F16C eight values at a
+// time where the build targets it, or the compiler's _Float16; without either it is unavailable.
+
+#ifndef W2V_HALF_H
+#define W2V_HALF_H
+
+#include <string.h>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+#define STORAGE_FP32 0
+#define STORAGE_BF16 1
+#define STORAGE_FP16 2
+
+static inline float Bf16ToFloat(unsigned short h) {
+  unsigned int u = (unsigned int)h << 16;
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+// Round to nearest even
+static inline unsigned short FloatToBf16(float f) {
+  unsigned int u;
+  memcpy(&u, &f, sizeof(u));
+  return (u + 0x7FFF + ((u >> 16) & 1)) >> 16;
+}
+
+// Rounds up with probability equal to the dropped fraction; r supplies 16 random bits
+static inline unsigned short FloatToBf16Stochastic(float f, unsigned int r) {
+  unsigned int u;
+  memcpy(&u, &f, sizeof(u));
+  return (u + (r & 0xFFFF)) >> 16;
+}
+
+#if defined(__F16C__)
+#define HALF_HAS_FP16 1
+static inline float Fp16ToFloat(unsigned short h) {
+  return _cvtsh_ss(h);
+}
+
+static inline unsigned short FloatToFp16(float f) {
+  return _cvtss_sh(f, 0);  // Round to nearest even
+}
+#elif defined(__FLT16_MAX__)
+#define HALF_HAS_FP16 1
+static inline float Fp16ToFloat(unsigned short h) {
+  _Float16 x;
+  memcpy(&x, &h, sizeof(x));
+  return x;
+}
+
+static inline unsigned short FloatToFp16(float f) {
+  _Float16 x = f;
+  unsigned short h;
+  memcpy(&h, &x, sizeof(h));
+  return h;
+}
+#else
+#define HALF_HAS_FP16 0
+static inline float Fp16ToFloat(unsigned short h) {
+  return 0;
+}
+
+static inline unsigned short FloatToFp16(float f) {
+  return 0;
+}
+#endif
+
+// 16 random bits for element i of a row written with stochastic rounding: a multiplicative hash
+// of a per-thread counter, so the rounding loops have no dependency between elements
+static inline unsigned int RoundingBits(unsigned long long counter, int i) {
+  return ((counter + i) * 0x9E3779B97F4A7C15ULL) >> 48;
+}
+
+// dst = src
+static inline void LoadHalfRow(const int n, float *dst, const unsigned short *src, int storage) {
+  int i = 0;
+  if (storage == STORAGE_BF16) {
+    for (; i < n; i++) dst[i] = Bf16ToFloat(src[i]);
+    return;
+  }
+#if defined(__F16C__)
+  for (; i + 8 <= n; i += 8) _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+#endif
+  for (; i < n; i++) dst[i] = Fp16ToFloat(src[i]);
+}
+
+// dst += src
+static inline void AccumulateHalfRow(const int n, float *dst, const unsigned short *src, int storage) {
+  int i = 0;
+  if (storage == STORAGE_BF16) {
+    for (; i < n; i++) dst[i] += Bf16ToFloat(src[i]);
+    return;
+  }
+#if defined(__F16C__)
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i)))));
+  }
+#endif
+  for (; i < n; i++) dst[i] += Fp16ToFloat(src[i]);
+}
+
+// dst = src, rounded; stochastic rounding of bf16 if random (the counter for RoundingBits()) is not NULL
+static inline void StoreHalfRow(const int n, unsigned short *dst, const float *src, int storage, unsigned long long *random) {
+  int i = 0;
+  if (storage == STORAGE_FP16) {
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), 0));
+#endif
+    for (; i < n; i++) dst[i] = FloatToFp16(src[i]);
+  } else if (random == NULL) {
+    for (; i < n; i++) dst[i] = FloatToBf16(src[i]);
+  } else {
+    for (; i < n; i++) dst[i] = FloatToBf16Stochastic(src[i], RoundingBits(*random, i));
+    *random += n;
+  }
+}
+
+// dst += delta, rounded like StoreHalfRow()
+static inline void AddToHalfRow(const int n, unsigned short *dst, const float *delta, int storage, unsigned long long *random) {
+  int i = 0;
+  if (storage == STORAGE_FP16) {
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+      __m256 v = _mm256_add_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(dst + i))), _mm256_loadu_ps(delta + i));
+      _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(v, 0));
+    }
+#endif
+    for (; i < n; i++) dst[i] = FloatToFp16(Fp16ToFloat(dst[i]) + delta[i]);
+  } else if (random == NULL) {
+    for (; i < n; i++) dst[i] = FloatToBf16(Bf16ToFloat(dst[i]) + delta[i]);
+  } else {
+    for (; i < n; i++) dst[i] = FloatToBf16Stochastic(Bf16ToFloat(dst[i]) + delta[i], RoundingBits(*random, i));
+    *random += n;
+  }
+}
+
+#endif
@@ -0,0 +1,186 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Word hash and the open-addressing table that maps words to vocabulary indices.
+//
+// HashWord() takes eight bytes per step and mixes the result, so that the top bits are usable as
+// the slot. Every slot is 8 bytes: the top 32 bits of the word's hash as a tag, and the word's
+// index. A lookup compares tags and only reads the word of a slot whose tag matches, normally just
+// the one it is looking for. Collisions are resolved by Robin Hood linear probing: an insertion
+// takes the slot of any word that is closer to its home slot than the new word is to its own, which
+// keeps probe sequences short and lets a lookup stop as soon as it meets such a word.
+//
+// The table has a power of two number of slots, doubles when it is 3/4 full, and is sized for the
+// vocabulary when it is rebuilt, so it is only as large as the vocabulary needs. Removal shifts
+// the following words back instead of leaving tombstones. The words themselves stay with the
+// caller, which passes a function that compares one with a word.
+
+#ifndef W2V_HASH_H
+#define W2V_HASH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+#define HASH_MIN_BITS 10
+
+static inline unsigned long long HashMix(unsigned long long h) {
+  h ^= h >> 32;
+  h *= HASH_MULTIPLIER;
+  return h ^ (h >> 29);
+}
+
+// Hash of the len bytes of word
+static inline unsigned long long HashWord(const char *word, int len) {
+  unsigned long long h = len * HASH_MULTIPLIER, v;
+  int a = 0;
+  for (; a + 8 <= len; a += 8) {
+    memcpy(&v, word + a, 8);
+    h = (h ^ v) * HASH_MULTIPLIER;
+    h ^= h >> 29;
+  }
+  if (a < len) {
+    v = 0;
+    memcpy(&v, word + a, len - a);
+    h = (h ^ v) * HASH_MULTIPLIER;
+  }
+  return HashMix(h);
+}
+
+struct hash_slot {
+  unsigned int tag;  // Top 32 bits of the hash; its top bits are the word's home slot
+  int index;         // Index of the word plus 1, 0 for a free slot
+};
+
+struct word_hash {
+  struct hash_slot *slots;
+  long long mask, count;
+  int bits;
+  // Where the slots come from: zeroed memory of the given size, and how it is given back
+  void *(*alloc)(long long bytes);
+  void (*release)(void *p);
+};
+
+// Tells whether the word with index is the len bytes of word; ctx is the caller's
+typedef int (*same_word_fn)(const void *ctx, int index, const char *word, int len);
+
+static void *HashAllocDefault(long long bytes) {
+  return calloc(1, bytes);
+}
+
+static void HashReleaseDefault(void *p) {
+  free(p);
+}
+
+static inline void AllocHashSlots(struct word_hash *h, int bits) {
+  h->bits = bits;
+  h->mask = (1LL << bits) - 1;
+  h->count = 0;
+  h->slots = (struct hash_slot *)h->alloc((h->mask + 1) * sizeof(struct hash_slot));
+  if (h->slots == NULL) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+}
+
+// Sets up an empty table for words words; alloc and release may be NULL for calloc() and free()
+static inline void InitWordHash(struct word_hash *h, long long words, void *(*alloc)(long long bytes), void (*release)(void *p)) {
+  int bits = HASH_MIN_BITS;
+  h->alloc = (alloc != NULL) ? alloc : HashAllocDefault;
+  h->release = (release != NULL) ? release : HashReleaseDefault;
+  while ((bits < 32) && ((1LL << bits) * 3 < words * 4)) bits++;
+  AllocHashSlots(h, bits);
+}
+
+static inline void FreeWordHash(struct word_hash *h) {
+  h->release(h->slots);
+  h->slots = NULL;
+}
+
+// Empties the table and sizes it for words words
+static inline void ResetWordHash(struct word_hash *h, long long words) {
+  FreeWordHash(h);
+  InitWordHash(h, words, h->alloc, h->release);
+}
+
+static inline void PlaceSlot(struct word_hash *h, struct hash_slot s) {
+  const int shift = 32 - h->bits;
+  long long pos = s.tag >> shift, dist = 0, d;
+  struct hash_slot t;
+  while (h->slots[pos].index != 0) {
+    d = (pos - (h->slots[pos].tag >> shift)) & h->mask;
+    if (d < dist) {  // Closer to home than s: s takes the slot, and it moves on
+      t = h->slots[pos];
+      h->slots[pos] = s;
+      s = t;
+      dist = d;
+    }
+    pos = (pos + 1) & h->mask;
+    dist++;
+  }
+  h->slots[pos] = s;
+  h->count++;
+}
+
+static inline void GrowWordHash(struct word_hash *h) {
+  struct hash_slot *old = h->slots;
+  long long a, size = h->mask + 1;
+  AllocHashSlots(h, h->bits + 1);
+  for (a = 0; a < size; a++) if (old[a].index != 0) PlaceSlot(h, old[a]);
+  h->release(old);
+}
+
+// Adds the word with index and hash; it must not be in the table yet
+static inline void WordHashInsert(struct word_hash *h, unsigned long long hash, int index) {
+  struct hash_slot s;
+  if ((h->count + 1) * 4 > (h->mask + 1) * 3) GrowWordHash(h);
+  s.tag = hash >> 32;
+  s.index = index + 1;
+  PlaceSlot(h, s);
+}
+
+// Removes the word with index and hash, which must be in the table. The words after it that are
+// away from their home slot move back by one, so no tombstone is left behind.
+static inline void WordHashRemove(struct word_hash *h, unsigned long long hash, int index) {
+  const int shift = 32 - h->bits;
+  long long pos = (hash >> 32) >> shift, next;
+  while (h->slots[pos].index != index + 1) pos = (pos + 1) & h->mask;
+  for (next = (pos + 1) & h->mask; h->slots[next].index != 0; next = (next + 1) & h->mask) {
+    if (next == (h->slots[next].tag >> shift)) break;  // At home already
+    h->slots[pos] = h->slots[next];
+    pos = next;
+  }
+  h->slots[pos].index = 0;
+  h->count--;
+}
+
+// Returns the index of the len bytes of word with hash, or -1 if it is not in the table
+static inline int WordHashFind(const struct word_hash *h, unsigned long long hash, const char *word, int len,
+                               same_word_fn same, const void *ctx) {
+  const int shift = 32 - h->bits;
+  const unsigned int tag = hash >> 32;
+  long long pos = tag >> shift, dist = 0;
+  const struct hash_slot *s;
+  while (1) {
+    s = &h->slots[pos];
+    if (s->index == 0) return -1;
+    if (((pos - (s->tag >> shift)) & h->mask) < dist) return -1;  // The word would have taken this slot
+    if ((s->tag == tag) && same(ctx, s->index - 1, word, len)) return s->index - 1;
+    pos = (pos + 1) & h->mask;
+    dist++;
+  }
+}
+
+#endif
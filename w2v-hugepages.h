@@ -0,0 +1,153 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Huge page backed allocation for the large arrays the trainer reads at random rows.
+//
+// With 4 KB pages every row of a multi-GB matrix is on its own page and nearly every access misses
+// the TLB. Explicit huge pages (MAP_HUGETLB) come from the pool the administrator reserved in
+// /proc/sys/vm/nr_hugepages (or the 1 GB pool under /sys/kernel/mm/hugepages); when the pool is too
+// small the next smaller kind is tried. Transparent huge pages need no reservation: the mapping is
+// aligned to 2 MB and advised with MADV_HUGEPAGE, and the kernel backs it with huge pages when it
+// can. Memory comes zeroed, and is given back with FreeHuge().
+
+#ifndef W2V_HUGEPAGES_H
+#define W2V_HUGEPAGES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define HUGE_OFF 0   // Normal pages
+#define HUGE_THP 1   // Transparent huge pages
+#define HUGE_2M 2    // Explicit 2 MB pages
+#define HUGE_1G 3    // Explicit 1 GB pages
+#define HUGE_MAX_ALLOCS 64
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static const char *huge_names[] = {"4 KB pages", "transparent huge pages", "explicit 2 MB pages", "explicit 1 GB pages"};
+
+// Every live mapping, so that FreeHuge() knows its length and ReportHugePages() what to look for
+static struct {
+  void *p;
+  long long length;
+  int kind;
+} huge_allocs[HUGE_MAX_ALLOCS];
+
+static inline long long HugePageSize(int kind) {
+  if (kind == HUGE_1G) return 1LL << 30;
+  if (kind == HUGE_2M || kind == HUGE_THP) return 1LL << 21;
+  return 4096;
+}
+
+// Maps bytes of zeroed memory with pages of the given kind. An explicit kind falls back to the next
+// smaller one when the pool has no room; *got is set to the kind obtained. Returns NULL only if no
+// memory can be mapped at all.
+static inline void *TryHugeMap(long long bytes, int kind, int *got, long long *length) {
+  long long page = HugePageSize(kind);
+  char *p, *aligned;
+  int a;
+  for (a = 0; a < HUGE_MAX_ALLOCS; a++) if (huge_allocs[a].p == NULL) break;
+  if (a == HUGE_MAX_ALLOCS) return NULL;
+  *length = (bytes + page - 1) / page * page;
+  if (kind >= HUGE_2M) {
+    int log2 = (kind == HUGE_1G) ? 30 : 21;
+    p = (char *)mmap(NULL, *length, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (log2 << MAP_HUGE_SHIFT), -1, 0);
+    if (p == MAP_FAILED) return TryHugeMap(bytes, kind - 1, got, length);
+    aligned = p;
+  } else if (kind == HUGE_THP) {
+    // Over-map by one huge page and trim, so the huge page boundaries fall inside the mapping
+    p = (char *)mmap(NULL, *length + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return TryHugeMap(bytes, HUGE_OFF, got, length);
+    aligned = (char *)(((unsigned long)p + page - 1) & ~(unsigned long)(page - 1));
+    if (aligned > p) munmap(p, aligned - p);
+    munmap(aligned + *length, p + page - aligned);
+    if (madvise(aligned, *length, MADV_HUGEPAGE) != 0) kind = HUGE_OFF;
+  } else {
+    p = (char *)mmap(NULL, *length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    madvise(p, *length, MADV_NOHUGEPAGE);  // Also when THP is set to always, for comparisons
+    aligned = p;
+  }
+  huge_allocs[a].p = aligned;
+  huge_allocs[a].length = *length;
+  huge_allocs[a].kind = kind;
+  *got = kind;
+  return aligned;
+}
+
+// Allocates bytes for the array called name, with pages of the kind asked for or the best one
+// available; logs what it got if verbose. Arrays smaller than half a page of the kind asked for
+// get the next smaller kind, so a 1 GB page is not spent on a few MB. Exits if there is no memory.
+static inline void *AllocHuge(long long bytes, int kind, const char *name, int verbose) {
+  long long length;
+  int got;
+  void *p;
+  while ((kind > HUGE_OFF) && (bytes < HugePageSize(kind) / 2)) kind--;
+  p = TryHugeMap(bytes, kind, &got, &length);
+  if (p == NULL) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  if (verbose) {
+    printf("%s: %.1f MB in %s%s\n", name, length / 1048576.0, huge_names[got], (got != kind) ? " (fallback)" : "");
+  }
+  return p;
+}
+
+static inline void FreeHuge(void *p) {
+  int a;
+  if (p == NULL) return;
+  for (a = 0; a < HUGE_MAX_ALLOCS; a++) if (huge_allocs[a].p == p) break;
+  if (a == HUGE_MAX_ALLOCS) return;
+  munmap(p, huge_allocs[a].length);
+  huge_allocs[a].p = NULL;
+}
+
+// Prints how much of the memory from AllocHuge() is backed by huge pages right now, from
+// /proc/self/smaps. Transparent huge pages only show up once the memory has been touched.
+static inline void ReportHugePages() {
+  char line[512];
+  unsigned long start = 0, end = 0;
+  long long total = 0, thp = 0, explicit_huge = 0, kb;
+  int in_alloc = 0, a;
+  FILE *f = fopen("/proc/self/smaps", "rb");
+  if (f == NULL) return;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+      in_alloc = 0;
+      for (a = 0; a < HUGE_MAX_ALLOCS; a++) {
+        unsigned long p = (unsigned long)huge_allocs[a].p;
+        if ((p != 0) && (p < end) && (p + huge_allocs[a].length > start)) in_alloc = 1;
+      }
+      if (in_alloc) total += end - start;
+    } else if (in_alloc && sscanf(line, "AnonHugePages: %lld kB", &kb) == 1) {
+      thp += kb << 10;
+    } else if (in_alloc && sscanf(line, "KernelPageSize: %lld kB", &kb) == 1 && kb > 4) {
+      explicit_huge += end - start;
+    }
+  }
+  fclose(f);
+  printf("Huge pages: %lld of %lld MB of weights and tables (%lld MB transparent, %lld MB explicit)\n",
+         (thp + explicit_huge) >> 20, total >> 20, thp >> 20, explicit_huge >> 20);
+}
+
+#endif
@@ -0,0 +1,569 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Vector kernels used by the training loop, in one implementation per instruction set.
+//
+// Every x86 variant is compiled with a target attribute rather than relying on -march, so one
+// binary carries all of them and SelectKernels() picks the best one the CPU supports at startup.
+// The AVX2 and AVX-512 versions finish the last partial vector with masked loads/stores instead
+// of a scalar loop. No alignment is assumed.
+//
+//   mac(n, a, b)       returns sum a[i] * b[i]
+//   add(n, a, b)       a[i] += b[i]
+//   mac1(n, out, c, b) out[i] += c * b[i]
+//   update(n, x, row, err, g)
+//                      err += g * row; row += g * x
+//   sigmoid_grad(n, f, label, alpha)
+//                      f[i] = (label[i] - sigmoid(f[i])) * alpha
+//
+// A step of hierarchical softmax / negative sampling is mac for every output row of a position, then
+// sigmoid_grad on all the scores at once, then update for every row: one pass doing both axpys while
+// the row is still in L1, instead of two that each stream the row in again. err is updated with the
+// row's old values.
+//
+// The sigmoid of sigmoid_grad is computed rather than looked up, as 1 / (1 + e^-x) with
+// e^x = 2^k * p(r) and p the degree 5 Cephes expf polynomial on |r| <= ln(2) / 2. It is within 1e-6
+// of the exact sigmoid, where the 512-entry table word2vec.c used to look it up in is off by up to
+// 3e-3 (w2v-bench sigmoid measures both), and saturates to 0 and 1 beyond |x| = 6 just as the
+// lookup did.
+//
+// For the common vector sizes in KERNEL_SIZES every set also has a copy compiled with n fixed,
+// so the loops are fully unrolled and the tail masks are constants. SizedKernels() returns the
+// copy for a given size, or the generic set if there is none.
+
+#ifndef W2V_KERNELS_H
+#define W2V_KERNELS_H
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+struct kernel_set {
+  const char *name;
+  int (*supported)(void);
+  float (*mac)(const int n, const float *a, const float *b);
+  void (*add)(const int n, float *a, const float *b);
+  void (*mac1)(const int n, float *out, float c, const float *b);
+  void (*update)(const int n, const float *x, float *row, float *err, float g);
+  void (*sigmoid_grad)(const int n, float *f, const float *label, float alpha);
+  int size;  // The n every call must use, 0 for any
+};
+
+#define SIGMOID_MAX 6.0f                 // Beyond +-SIGMOID_MAX the sigmoid is taken as 1 or 0
+#define SIGMOID_LOG2E 1.44269504088896341f
+#define SIGMOID_LN2_HI 0.693359375f       // ln(2) in two parts, the first exact in a few bits
+#define SIGMOID_LN2_LO -2.12194440e-4f
+#define SIGMOID_P0 1.9875691500e-4f
+#define SIGMOID_P1 1.3981999507e-3f
+#define SIGMOID_P2 8.3334519073e-3f
+#define SIGMOID_P3 4.1665795894e-2f
+#define SIGMOID_P4 1.6666665459e-1f
+#define SIGMOID_P5 5.0000001201e-1f
+
+static inline float SigmoidPoly(float f) {
+  float x = (f > SIGMOID_MAX) ? -SIGMOID_MAX : ((f < -SIGMOID_MAX) ? SIGMOID_MAX : -f), k, r, y, scale;
+  int e = (int)(x * SIGMOID_LOG2E + 128.5f) - 128;  // Nearest integer, for |x| well below 128
+  unsigned int bits = (unsigned int)(e + 127) << 23;
+  k = e;
+  r = x - k * SIGMOID_LN2_HI - k * SIGMOID_LN2_LO;
+  y = ((((SIGMOID_P0 * r + SIGMOID_P1) * r + SIGMOID_P2) * r + SIGMOID_P3) * r + SIGMOID_P4) * r + SIGMOID_P5;
+  y = y * r * r + r + 1;
+  memcpy(&scale, &bits, sizeof(scale));
+  if (f >= SIGMOID_MAX) return 1;
+  if (f <= -SIGMOID_MAX) return 0;
+  return 1 / (1 + y * scale);
+}
+
+static int KernelAlways(void) {
+  return 1;
+}
+
+static float MacScalar(const int n, const float *a, const float *b) {
+  float output = 0;
+  int i;
+  for (i = 0; i < n; i++) output += a[i] * b[i];
+  return output;
+}
+
+static void AddScalar(const int n, float *a, const float *b) {
+  int i;
+  for (i = 0; i < n; i++) a[i] += b[i];
+}
+
+static void Mac1Scalar(const int n, float *out, float c, const float *b) {
+  int i;
+  for (i = 0; i < n; i++) out[i] += c * b[i];
+}
+
+static void UpdateScalar(const int n, const float *x, float *row, float *err, float g) {
+  float r;
+  int i;
+  for (i = 0; i < n; i++) {
+    r = row[i];
+    err[i] += g * r;
+    row[i] = r + g * x[i];
+  }
+}
+
+static void SigmoidGradScalar(const int n, float *f, const float *label, float alpha) {
+  int i;
+  for (i = 0; i < n; i++) f[i] = (label[i] - SigmoidPoly(f[i])) * alpha;
+}
+
+#ifdef KERNELS_X86
+__attribute__((target("sse2")))
+static float MacSSE(const int n, const float *a, const float *b) {
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+  float tmp[4], output;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+  if (i + 4 <= n) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    i += 4;
+  }
+  _mm_storeu_ps(tmp, _mm_add_ps(s0, s1));
+  output = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+  // Restarting from n & ~3 (which i already is) keeps gcc from misjudging the trip count when n is constant
+  for (i = n & ~3; i < n; i++) output += a[i] * b[i];
+  return output;
+}
+
+__attribute__((target("sse2")))
+static void AddSSE(const int n, float *a, const float *b) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) _mm_storeu_ps(a + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  for (; i < n; i++) a[i] += b[i];
+}
+
+__attribute__((target("sse2")))
+static void Mac1SSE(const int n, float *out, float c, const float *b) {
+  __m128 vc = _mm_set1_ps(c);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(vc, _mm_loadu_ps(b + i))));
+  for (; i < n; i++) out[i] += c * b[i];
+}
+
+__attribute__((target("sse2")))
+static void UpdateSSE(const int n, const float *x, float *row, float *err, float g) {
+  float r;
+  __m128 vg = _mm_set1_ps(g), vr;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vr = _mm_loadu_ps(row + i);
+    _mm_storeu_ps(err + i, _mm_add_ps(_mm_loadu_ps(err + i), _mm_mul_ps(vg, vr)));
+    _mm_storeu_ps(row + i, _mm_add_ps(vr, _mm_mul_ps(vg, _mm_loadu_ps(x + i))));
+  }
+  for (; i < n; i++) {
+    r = row[i];
+    err[i] += g * r;
+    row[i] = r + g * x[i];
+  }
+}
+
+__attribute__((target("sse2")))
+static inline __m128 SigmoidSSE(__m128 f) {
+  __m128 vmax = _mm_set1_ps(SIGMOID_MAX), one = _mm_set1_ps(1);
+  __m128 x = _mm_sub_ps(_mm_setzero_ps(), _mm_min_ps(_mm_max_ps(f, _mm_sub_ps(_mm_setzero_ps(), vmax)), vmax));
+  __m128i e = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(SIGMOID_LOG2E)));
+  __m128 k = _mm_cvtepi32_ps(e), r, y, s;
+  r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(k, _mm_set1_ps(SIGMOID_LN2_HI))), _mm_mul_ps(k, _mm_set1_ps(SIGMOID_LN2_LO)));
+  y = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(SIGMOID_P0), r), _mm_set1_ps(SIGMOID_P1));
+  y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(SIGMOID_P2));
+  y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(SIGMOID_P3));
+  y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(SIGMOID_P4));
+  y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(SIGMOID_P5));
+  y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(r, r)), r), one);
+  y = _mm_mul_ps(y, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(e, _mm_set1_epi32(127)), 23)));
+  s = _mm_div_ps(one, _mm_add_ps(one, y));
+  s = _mm_or_ps(_mm_andnot_ps(_mm_cmpge_ps(f, vmax), s), _mm_and_ps(_mm_cmpge_ps(f, vmax), one));
+  return _mm_andnot_ps(_mm_cmple_ps(f, _mm_sub_ps(_mm_setzero_ps(), vmax)), s);
+}
+
+__attribute__((target("sse2")))
+static void SigmoidGradSSE(const int n, float *f, const float *label, float alpha) {
+  __m128 va = _mm_set1_ps(alpha);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(f + i, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(label + i), SigmoidSSE(_mm_loadu_ps(f + i))), va));
+  }
+  for (; i < n; i++) f[i] = (label[i] - SigmoidPoly(f[i])) * alpha;
+}
+
+static int SupportedAVX2(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+// Lanes [0, rem) enabled
+__attribute__((target("avx2,fma")))
+static inline __m256i TailMaskAVX2(int rem) {
+  return _mm256_cmpgt_epi32(_mm256_set1_epi32(rem), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+__attribute__((target("avx2,fma")))
+static float MacAVX2(const int n, const float *a, const float *b) {
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  __m128 s;
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+    s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+  }
+  if (i + 8 <= n) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+    i += 8;
+  }
+  if (i < n) {
+    __m256i m = TailMaskAVX2(n - i);
+    s1 = _mm256_fmadd_ps(_mm256_maskload_ps(a + i, m), _mm256_maskload_ps(b + i, m), s1);
+  }
+  s0 = _mm256_add_ps(s0, s1);
+  s = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+static void AddAVX2(const int n, float *a, const float *b) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) _mm256_storeu_ps(a + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  if (i < n) {
+    __m256i m = TailMaskAVX2(n - i);
+    _mm256_maskstore_ps(a + i, m, _mm256_add_ps(_mm256_maskload_ps(a + i, m), _mm256_maskload_ps(b + i, m)));
+  }
+}
+
+__attribute__((target("avx2,fma")))
+static void Mac1AVX2(const int n, float *out, float c, const float *b) {
+  __m256 vc = _mm256_set1_ps(c);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) _mm256_storeu_ps(out + i, _mm256_fmadd_ps(vc, _mm256_loadu_ps(b + i), _mm256_loadu_ps(out + i)));
+  if (i < n) {
+    __m256i m = TailMaskAVX2(n - i);
+    _mm256_maskstore_ps(out + i, m, _mm256_fmadd_ps(vc, _mm256_maskload_ps(b + i, m), _mm256_maskload_ps(out + i, m)));
+  }
+}
+
+__attribute__((target("avx2,fma")))
+static void UpdateAVX2(const int n, const float *x, float *row, float *err, float g) {
+  __m256 vg = _mm256_set1_ps(g), vr;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    vr = _mm256_loadu_ps(row + i);
+    _mm256_storeu_ps(err + i, _mm256_fmadd_ps(vg, vr, _mm256_loadu_ps(err + i)));
+    _mm256_storeu_ps(row + i, _mm256_fmadd_ps(vg, _mm256_loadu_ps(x + i), vr));
+  }
+  if (i < n) {
+    __m256i m = TailMaskAVX2(n - i);
+    vr = _mm256_maskload_ps(row + i, m);
+    _mm256_maskstore_ps(err + i, m, _mm256_fmadd_ps(vg, vr, _mm256_maskload_ps(err + i, m)));
+    _mm256_maskstore_ps(row + i, m, _mm256_fmadd_ps(vg, _mm256_maskload_ps(x + i, m), vr));
+  }
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 SigmoidAVX2(__m256 f) {
+  __m256 vmax = _mm256_set1_ps(SIGMOID_MAX), vmin = _mm256_set1_ps(-SIGMOID_MAX), one = _mm256_set1_ps(1);
+  __m256 x = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_min_ps(_mm256_max_ps(f, vmin), vmax));
+  __m256i e = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(SIGMOID_LOG2E)));
+  __m256 k = _mm256_cvtepi32_ps(e), r, y, s;
+  r = _mm256_fnmadd_ps(k, _mm256_set1_ps(SIGMOID_LN2_LO), _mm256_fnmadd_ps(k, _mm256_set1_ps(SIGMOID_LN2_HI), x));
+  y = _mm256_fmadd_ps(_mm256_set1_ps(SIGMOID_P0), r, _mm256_set1_ps(SIGMOID_P1));
+  y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(SIGMOID_P2));
+  y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(SIGMOID_P3));
+  y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(SIGMOID_P4));
+  y = _mm256_fmadd_ps(y, r, _mm256_set1_ps(SIGMOID_P5));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(r, r), _mm256_add_ps(r, one));
+  y = _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(e, _mm256_set1_epi32(127)), 23)));
+  s = _mm256_div_ps(one, _mm256_add_ps(one, y));
+  s = _mm256_blendv_ps(s, one, _mm256_cmp_ps(f, vmax, _CMP_GE_OQ));
+  return _mm256_blendv_ps(s, _mm256_setzero_ps(), _mm256_cmp_ps(f, vmin, _CMP_LE_OQ));
+}
+
+__attribute__((target("avx2,fma")))
+static void SigmoidGradAVX2(const int n, float *f, const float *label, float alpha) {
+  __m256 va = _mm256_set1_ps(alpha);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(f + i, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(label + i), SigmoidAVX2(_mm256_loadu_ps(f + i))), va));
+  }
+  if (i < n) {
+    __m256i m = TailMaskAVX2(n - i);
+    __m256 g = _mm256_sub_ps(_mm256_maskload_ps(label + i, m), SigmoidAVX2(_mm256_maskload_ps(f + i, m)));
+    _mm256_maskstore_ps(f + i, m, _mm256_mul_ps(g, va));
+  }
+}
+
+static int SupportedAVX512(void) {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f");
+}
+
+__attribute__((target("avx512f")))
+static float MacAVX512(const int n, const float *a, const float *b) {
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+    s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), s1);
+  }
+  if (i + 16 <= n) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+    i += 16;
+  }
+  if (i < n) {
+    __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+    s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), s1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+__attribute__((target("avx512f")))
+static void AddAVX512(const int n, float *a, const float *b) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) _mm512_storeu_ps(a + i, _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+  if (i < n) {
+    __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+    _mm512_mask_storeu_ps(a + i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i)));
+  }
+}
+
+__attribute__((target("avx512f")))
+static void Mac1AVX512(const int n, float *out, float c, const float *b) {
+  __m512 vc = _mm512_set1_ps(c);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) _mm512_storeu_ps(out + i, _mm512_fmadd_ps(vc, _mm512_loadu_ps(b + i), _mm512_loadu_ps(out + i)));
+  if (i < n) {
+    __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+    _mm512_mask_storeu_ps(out + i, m, _mm512_fmadd_ps(vc, _mm512_maskz_loadu_ps(m, b + i), _mm512_maskz_loadu_ps(m, out + i)));
+  }
+}
+
+__attribute__((target("avx512f")))
+static void UpdateAVX512(const int n, const float *x, float *row, float *err, float g) {
+  __m512 vg = _mm512_set1_ps(g), vr;
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    vr = _mm512_loadu_ps(row + i);
+    _mm512_storeu_ps(err + i, _mm512_fmadd_ps(vg, vr, _mm512_loadu_ps(err + i)));
+    _mm512_storeu_ps(row + i, _mm512_fmadd_ps(vg, _mm512_loadu_ps(x + i), vr));
+  }
+  if (i < n) {
+    __mmask16 m = (__mmask16)((1u << (n - i)) - 1);
+    vr = _mm512_maskz_loadu_ps(m, row + i);
+    _mm512_mask_storeu_ps(err + i, m, _mm512_fmadd_ps(vg, vr, _mm512_maskz_loadu_ps(m, err + i)));
+    _mm512_mask_storeu_ps(row + i, m, _mm512_fmadd_ps(vg, _mm512_maskz_loadu_ps(m, x + i), vr));
+  }
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 SigmoidAVX512(__m512 f) {
+  __m512 vmax = _mm512_set1_ps(SIGMOID_MAX), vmin = _mm512_set1_ps(-SIGMOID_MAX), one = _mm512_set1_ps(1);
+  __m512 x = _mm512_sub_ps(_mm512_setzero_ps(), _mm512_min_ps(_mm512_max_ps(f, vmin), vmax));
+  __m512i e = _mm512_cvtps_epi32(_mm512_mul_ps(x, _mm512_set1_ps(SIGMOID_LOG2E)));
+  __m512 k = _mm512_cvtepi32_ps(e), r, y, s;
+  r = _mm512_fnmadd_ps(k, _mm512_set1_ps(SIGMOID_LN2_LO), _mm512_fnmadd_ps(k, _mm512_set1_ps(SIGMOID_LN2_HI), x));
+  y = _mm512_fmadd_ps(_mm512_set1_ps(SIGMOID_P0), r, _mm512_set1_ps(SIGMOID_P1));
+  y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(SIGMOID_P2));
+  y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(SIGMOID_P3));
+  y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(SIGMOID_P4));
+  y = _mm512_fmadd_ps(y, r, _mm512_set1_ps(SIGMOID_P5));
+  y = _mm512_fmadd_ps(y, _mm512_mul_ps(r, r), _mm512_add_ps(r, one));
+  y = _mm512_mul_ps(y, _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(e, _mm512_set1_epi32(127)), 23)));
+  s = _mm512_div_ps(one, _mm512_add_ps(one, y));
+  s = _mm512_mask_mov_ps(s, _mm512_cmp_ps_mask(f, vmax, _CMP_GE_OQ), one);
+  return _mm512_mask_mov_ps(s, _mm512_cmp_ps_mask(f, vmin, _CMP_LE_OQ), _mm512_setzero_ps());
+}
+
+// 1 + negative is at most 16 for the usual settings, which makes this a single masked step
+__attribute__((target("avx512f")))
+static void SigmoidGradAVX512(const int n, float *f, const float *label, float alpha) {
+  __m512 va = _mm512_set1_ps(alpha);
+  __mmask16 m;
+  int i;
+  for (i = 0; i < n; i += 16) {
+    m = (n - i >= 16) ? 0xFFFF : (__mmask16)((1u << (n - i)) - 1);
+    __m512 g = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, label + i), SigmoidAVX512(_mm512_maskz_loadu_ps(m, f + i)));
+    _mm512_mask_storeu_ps(f + i, m, _mm512_mul_ps(g, va));
+  }
+}
+#endif
+
+#if defined(__aarch64__)
+static float MacNEON(const int n, const float *a, const float *b) {
+  float32x4_t s0 = vdupq_n_f32(0), s1 = vdupq_n_f32(0);
+  float output;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    s0 = vfmaq_f32(s0, vld1q_f32(a + i), vld1q_f32(b + i));
+    s1 = vfmaq_f32(s1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  if (i + 4 <= n) {
+    s0 = vfmaq_f32(s0, vld1q_f32(a + i), vld1q_f32(b + i));
+    i += 4;
+  }
+  output = vaddvq_f32(vaddq_f32(s0, s1));
+  for (i = n & ~3; i < n; i++) output += a[i] * b[i];
+  return output;
+}
+
+static void AddNEON(const int n, float *a, const float *b) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) vst1q_f32(a + i, vaddq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+  for (; i < n; i++) a[i] += b[i];
+}
+
+static void Mac1NEON(const int n, float *out, float c, const float *b) {
+  float32x4_t vc = vdupq_n_f32(c);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) vst1q_f32(out + i, vfmaq_f32(vld1q_f32(out + i), vc, vld1q_f32(b + i)));
+  for (; i < n; i++) out[i] += c * b[i];
+}
+
+static void UpdateNEON(const int n, const float *x, float *row, float *err, float g) {
+  float r;
+  float32x4_t vg = vdupq_n_f32(g), vr;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vr = vld1q_f32(row + i);
+    vst1q_f32(err + i, vfmaq_f32(vld1q_f32(err + i), vg, vr));
+    vst1q_f32(row + i, vfmaq_f32(vr, vg, vld1q_f32(x + i)));
+  }
+  for (; i < n; i++) {
+    r = row[i];
+    err[i] += g * r;
+    row[i] = r + g * x[i];
+  }
+}
+
+static inline float32x4_t SigmoidNEON(float32x4_t f) {
+  float32x4_t vmax = vdupq_n_f32(SIGMOID_MAX), vmin = vdupq_n_f32(-SIGMOID_MAX), one = vdupq_n_f32(1);
+  float32x4_t x = vnegq_f32(vminq_f32(vmaxq_f32(f, vmin), vmax));
+  int32x4_t e = vcvtnq_s32_f32(vmulq_f32(x, vdupq_n_f32(SIGMOID_LOG2E)));
+  float32x4_t k = vcvtq_f32_s32(e), r, y, s;
+  r = vfmsq_f32(vfmsq_f32(x, k, vdupq_n_f32(SIGMOID_LN2_HI)), k, vdupq_n_f32(SIGMOID_LN2_LO));
+  y = vfmaq_f32(vdupq_n_f32(SIGMOID_P1), vdupq_n_f32(SIGMOID_P0), r);
+  y = vfmaq_f32(vdupq_n_f32(SIGMOID_P2), y, r);
+  y = vfmaq_f32(vdupq_n_f32(SIGMOID_P3), y, r);
+  y = vfmaq_f32(vdupq_n_f32(SIGMOID_P4), y, r);
+  y = vfmaq_f32(vdupq_n_f32(SIGMOID_P5), y, r);
+  y = vfmaq_f32(vaddq_f32(r, one), y, vmulq_f32(r, r));
+  y = vmulq_f32(y, vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(e, vdupq_n_s32(127)), 23)));
+  s = vdivq_f32(one, vaddq_f32(one, y));
+  s = vbslq_f32(vcgeq_f32(f, vmax), one, s);
+  return vbslq_f32(vcleq_f32(f, vmin), vdupq_n_f32(0), s);
+}
+
+static void SigmoidGradNEON(const int n, float *f, const float *label, float alpha) {
+  float32x4_t va = vdupq_n_f32(alpha);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) vst1q_f32(f + i, vmulq_f32(vsubq_f32(vld1q_f32(label + i), SigmoidNEON(vld1q_f32(f + i))), va));
+  for (; i < n; i++) f[i] = (label[i] - SigmoidPoly(f[i])) * alpha;
+}
+#endif
+
+// Best first
+static const struct kernel_set kernel_sets[] = {
+#ifdef KERNELS_X86
+  {"avx512", SupportedAVX512, MacAVX512, AddAVX512, Mac1AVX512, UpdateAVX512, SigmoidGradAVX512, 0},
+  {"avx2", SupportedAVX2, MacAVX2, AddAVX2, Mac1AVX2, UpdateAVX2, SigmoidGradAVX2, 0},
+  {"sse", KernelAlways, MacSSE, AddSSE, Mac1SSE, UpdateSSE, SigmoidGradSSE, 0},
+#endif
+#if defined(__aarch64__)
+  {"neon", KernelAlways, MacNEON, AddNEON, Mac1NEON, UpdateNEON, SigmoidGradNEON, 0},
+#endif
+  {"scalar", KernelAlways, MacScalar, AddScalar, Mac1Scalar, UpdateScalar, SigmoidGradScalar, 0},
+};
+
+// Calls X(size, ...) for every vector size that gets specialized kernels
+#define KERNEL_SIZES(X, ...) X(100, __VA_ARGS__) X(128, __VA_ARGS__) X(200, __VA_ARGS__) \
+  X(256, __VA_ARGS__) X(300, __VA_ARGS__) X(512, __VA_ARGS__)
+
+// Wrappers with a constant n; flatten inlines the generic kernel so the constant propagates.
+// attr is the target attribute of the generic kernels, or nothing.
+#define SIZED_KERNELS(size, isa, attr) \
+attr __attribute__((flatten)) \
+static float Mac##isa##_##size(const int n, const float *a, const float *b) { \
+  return Mac##isa(size, a, b); \
+} \
+attr __attribute__((flatten)) \
+static void Add##isa##_##size(const int n, float *a, const float *b) { \
+  Add##isa(size, a, b); \
+} \
+attr __attribute__((flatten)) \
+static void Mac1##isa##_##size(const int n, float *out, float c, const float *b) { \
+  Mac1##isa(size, out, c, b); \
+} \
+attr __attribute__((flatten)) \
+static void Update##isa##_##size(const int n, const float *x, float *row, float *err, float g) { \
+  Update##isa(size, x, row, err, g); \
+}
+
+#define SIZED_KERNEL_SET(size, isa, name, supported) \
+  {name, supported, Mac##isa##_##size, Add##isa##_##size, Mac1##isa##_##size, Update##isa##_##size, SigmoidGrad##isa, size},
+
+#ifdef KERNELS_X86
+KERNEL_SIZES(SIZED_KERNELS, AVX512, __attribute__((target("avx512f"))))
+KERNEL_SIZES(SIZED_KERNELS, AVX2, __attribute__((target("avx2,fma"))))
+KERNEL_SIZES(SIZED_KERNELS, SSE, __attribute__((target("sse2"))))
+#endif
+#if defined(__aarch64__)
+KERNEL_SIZES(SIZED_KERNELS, NEON, )
+#endif
+KERNEL_SIZES(SIZED_KERNELS, Scalar, )
+
+static const struct kernel_set sized_kernel_sets[] = {
+#ifdef KERNELS_X86
+  KERNEL_SIZES(SIZED_KERNEL_SET, AVX512, "avx512", SupportedAVX512)
+  KERNEL_SIZES(SIZED_KERNEL_SET, AVX2, "avx2", SupportedAVX2)
+  KERNEL_SIZES(SIZED_KERNEL_SET, SSE, "sse", KernelAlways)
+#endif
+#if defined(__aarch64__)
+  KERNEL_SIZES(SIZED_KERNEL_SET, NEON, "neon", KernelAlways)
+#endif
+  KERNEL_SIZES(SIZED_KERNEL_SET, Scalar, "scalar", KernelAlways)
+};
+
+// Returns the named kernel set, or the best supported one if name is NULL or empty.
+// Returns NULL if the name is unknown or not supported by this CPU.
+static inline const struct kernel_set *SelectKernels(const char *name) {
+  int a;
+  for (a = 0; a < sizeof(kernel_sets) / sizeof(kernel_sets[0]); a++) {
+    if ((name != NULL) && (name[0] != 0) && strcmp(name, kernel_sets[a].name)) continue;
+    if (kernel_sets[a].supported()) return &kernel_sets[a];
+    if ((name != NULL) && (name[0] != 0)) return NULL;
+  }
+  return NULL;
+}
+
+// Returns the copy of ks specialized for vectors of the given size, or ks itself if there is none
+static inline const struct kernel_set *SizedKernels(const struct kernel_set *ks, int size) {
+  int a;
+  for (a = 0; a < sizeof(sized_kernel_sets) / sizeof(sized_kernel_sets[0]); a++) {
+    if ((sized_kernel_sets[a].size == size) && !strcmp(sized_kernel_sets[a].name, ks->name)) return &sized_kernel_sets[a];
+  }
+  return ks;
+}
+
+#endif
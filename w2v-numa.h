@@ -0,0 +1,173 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// NUMA placement without libnuma: topology from /sys, memory policy through the mbind and
+// move_pages system calls, thread pinning through pthread affinity. Needs _GNU_SOURCE.
+//
+// Hogwild training reads and writes rows of the weight matrices at random, so no partition of
+// them is local to any thread. Interleaving their pages over all nodes spreads the traffic evenly
+// over the memory controllers instead of sending all of it to the node that touched them first.
+// Threads are pinned one per physical core, alternating between nodes, and SMT siblings are only
+// used once every core has a thread; buffers a thread allocates after pinning are node-local.
+
+#ifndef W2V_NUMA_H
+#define W2V_NUMA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define NUMA_MAX_NODES 64
+#define NUMA_MAX_CPUS 1024
+#define NUMA_MPOL_INTERLEAVE 3      // MPOL_INTERLEAVE from <numaif.h>
+#define NUMA_MPOL_MF_MOVE (1 << 1)  // MPOL_MF_MOVE
+#define NUMA_SAMPLE_PAGES 4096
+
+struct numa_topology {
+  int num_nodes, num_cpus;
+  int node_ids[NUMA_MAX_NODES];  // System node numbers
+  int cpus[NUMA_MAX_CPUS];       // Usable CPUs in pinning order
+  int cpu_node[NUMA_MAX_CPUS];   // Index into node_ids of cpus[i]
+};
+
+// Parses a /sys CPU or node list such as "0-3,8,10-11" into a flag array
+static inline void ParseCpuList(const char *s, char *flags, int max) {
+  int a, b, i;
+  while (*s) {
+    if (sscanf(s, "%d", &a) != 1) break;
+    b = a;
+    while ((*s >= '0') && (*s <= '9')) s++;
+    if (*s == '-') {
+      s++;
+      if (sscanf(s, "%d", &b) != 1) break;
+      while ((*s >= '0') && (*s <= '9')) s++;
+    }
+    if (a < 0) a = 0;
+    for (i = a; (i <= b) && (i < max); i++) flags[i] = 1;
+    if (*s == ',') s++; else break;
+  }
+}
+
+static inline int ReadSysList(const char *path, char *flags, int max) {
+  char line[4096];
+  FILE *f = fopen(path, "rb");
+  memset(flags, 0, max);
+  if (f == NULL) return 0;
+  if (fgets(line, sizeof(line), f) != NULL) ParseCpuList(line, flags, max);
+  fclose(f);
+  return 1;
+}
+
+// Fills t with the nodes and the CPUs this process may run on. Without /sys/devices/system/node
+// everything is one node.
+static inline void ReadNumaTopology(struct numa_topology *t) {
+  static char online[NUMA_MAX_NODES], node_cpus[NUMA_MAX_NODES][NUMA_MAX_CPUS], siblings[NUMA_MAX_CPUS];
+  char path[256];
+  int cpu_rank[NUMA_MAX_CPUS], cpu_node[NUMA_MAX_CPUS], node, cpu, rank, max_rank = 0, n, i;
+  cpu_set_t allowed;
+  memset(t, 0, sizeof(*t));
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  if (!ReadSysList("/sys/devices/system/node/online", online, NUMA_MAX_NODES)) online[0] = 1;
+  for (node = 0; node < NUMA_MAX_NODES; node++) {
+    if (!online[node]) continue;
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (!ReadSysList(path, node_cpus[t->num_nodes], NUMA_MAX_CPUS)) {
+      for (cpu = 0; cpu < NUMA_MAX_CPUS; cpu++) node_cpus[t->num_nodes][cpu] = 1;
+    }
+    t->node_ids[t->num_nodes++] = node;
+  }
+  // SMT rank of every usable CPU: its position among the hardware threads of its core
+  for (cpu = 0; cpu < NUMA_MAX_CPUS; cpu++) {
+    cpu_node[cpu] = -1;
+    if (!CPU_ISSET(cpu, &allowed)) continue;
+    for (n = 0; n < t->num_nodes; n++) if (node_cpus[n][cpu]) break;
+    if (n == t->num_nodes) continue;
+    cpu_node[cpu] = n;
+    cpu_rank[cpu] = 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    if (ReadSysList(path, siblings, NUMA_MAX_CPUS)) for (i = 0; i < cpu; i++) cpu_rank[cpu] += siblings[i];
+    if (cpu_rank[cpu] > max_rank) max_rank = cpu_rank[cpu];
+  }
+  // First hardware thread of every core, taking one CPU from each node in turn, then the siblings
+  for (rank = 0; rank <= max_rank; rank++) {
+    int next[NUMA_MAX_NODES], more = 1;
+    memset(next, 0, sizeof(next));
+    while (more) {
+      more = 0;
+      for (n = 0; n < t->num_nodes; n++) {
+        for (cpu = next[n]; cpu < NUMA_MAX_CPUS; cpu++) if ((cpu_node[cpu] == n) && (cpu_rank[cpu] == rank)) break;
+        next[n] = cpu + 1;
+        if (cpu == NUMA_MAX_CPUS) continue;
+        t->cpus[t->num_cpus] = cpu;
+        t->cpu_node[t->num_cpus++] = n;
+        more = 1;
+      }
+    }
+  }
+}
+
+// Pins the calling thread to the index-th CPU of the pinning order; returns its node index
+static inline int PinThread(const struct numa_topology *t, long long index) {
+  cpu_set_t set;
+  if (t->num_cpus == 0) return 0;
+  index %= t->num_cpus;
+  CPU_ZERO(&set);
+  CPU_SET(t->cpus[index], &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  return t->cpu_node[index];
+}
+
+// Restricts the calling thread to the CPUs of one node
+static inline void PinThreadToNode(const struct numa_topology *t, int node) {
+  cpu_set_t set;
+  int i;
+  CPU_ZERO(&set);
+  for (i = 0; i < t->num_cpus; i++) if (t->cpu_node[i] == node) CPU_SET(t->cpus[i], &set);
+  if (CPU_COUNT(&set) > 0) pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Interleaves the pages of [p, p + size) over all nodes. Best called before the memory is first
+// touched; pages that already exist are migrated. Returns 0 on success.
+static inline int InterleaveMemory(const struct numa_topology *t, void *p, long long size) {
+  unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1];
+  long page = sysconf(_SC_PAGESIZE);
+  unsigned long start = ((unsigned long)p + page - 1) & ~(unsigned long)(page - 1);
+  unsigned long end = ((unsigned long)p + size) & ~(unsigned long)(page - 1);
+  int n;
+  if (end <= start) return 0;
+  memset(mask, 0, sizeof(mask));
+  for (n = 0; n < t->num_nodes; n++) mask[t->node_ids[n] / (8 * sizeof(unsigned long))] |= 1UL << (t->node_ids[n] % (8 * sizeof(unsigned long)));
+  return syscall(SYS_mbind, start, end - start, NUMA_MPOL_INTERLEAVE, mask, NUMA_MAX_NODES + 1, NUMA_MPOL_MF_MOVE);
+}
+
+// Adds to pages[n] the number of pages of [p, p + size) found on node index n, sampling at most
+// NUMA_SAMPLE_PAGES pages. Pages not yet touched are not counted.
+static inline void CountMemoryNodes(const struct numa_topology *t, void *p, long long size, long long *pages) {
+  void *addr[NUMA_SAMPLE_PAGES];
+  int status[NUMA_SAMPLE_PAGES], count = 0, i, n;
+  long page = sysconf(_SC_PAGESIZE);
+  long long total = size / page, step, a;
+  if (total == 0) return;
+  step = (total + NUMA_SAMPLE_PAGES - 1) / NUMA_SAMPLE_PAGES;
+  for (a = 0; a < total; a += step) addr[count++] = (char *)p + a * page;
+  if (syscall(SYS_move_pages, 0, count, addr, NULL, status, 0) != 0) return;
+  for (i = 0; i < count; i++) for (n = 0; n < t->num_nodes; n++) if (status[i] == t->node_ids[n]) pages[n] += step;
+}
+
+#endif
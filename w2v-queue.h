@@ -0,0 +1,95 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Bounded lock-free multi-producer / multi-consumer queue of pointers.
+//
+// Every cell carries a sequence number that tells producers and consumers whether it is free
+// for the current lap, so push and pop are a single CAS on the tail/head counter when there
+// is no contention. Neither call blocks: push returns 0 when full, pop returns NULL when empty.
+
+#ifndef W2V_QUEUE_H
+#define W2V_QUEUE_H
+
+#include <stdlib.h>
+
+struct ring_cell {
+  long long seq;
+  void *data;
+};
+
+struct ring {
+  struct ring_cell *cells;
+  long long mask;
+  char pad0[64];
+  long long head;  // Next cell to pop
+  char pad1[64];
+  long long tail;  // Next cell to push
+  char pad2[64];
+};
+
+// size must be a power of two
+static inline void InitRing(struct ring *r, long long size) {
+  long long a;
+  r->cells = (struct ring_cell *)calloc(size, sizeof(struct ring_cell));
+  for (a = 0; a < size; a++) r->cells[a].seq = a;
+  r->mask = size - 1;
+  r->head = r->tail = 0;
+}
+
+static inline void FreeRing(struct ring *r) {
+  free(r->cells);
+}
+
+static inline int RingPush(struct ring *r, void *data) {
+  struct ring_cell *cell;
+  long long pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED), dif;
+  while (1) {
+    cell = &r->cells[pos & r->mask];
+    dif = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos;
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if (dif < 0) {
+      return 0;
+    } else pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+  }
+  cell->data = data;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static inline void *RingPop(struct ring *r) {
+  struct ring_cell *cell;
+  long long pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED), dif;
+  void *data;
+  while (1) {
+    cell = &r->cells[pos & r->mask];
+    dif = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1);
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if (dif < 0) {
+      return NULL;
+    } else pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+  }
+  data = cell->data;
+  __atomic_store_n(&cell->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+  return data;
+}
+
+// Approximate number of queued entries, for statistics only
+static inline long long RingCount(struct ring *r) {
+  long long count = __atomic_load_n(&r->tail, __ATOMIC_RELAXED) - __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+  return (count < 0) ? 0 : count;
+}
+
+#endif
@@ -0,0 +1,131 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Walker / Vose alias sampler for the negative sampling distribution.
+//
+// The table has one 8-byte entry per word, instead of the 2^27 entry unigram table. A draw picks
+// a bucket uniformly and keeps it or takes its alias depending on the bucket's threshold, so it
+// costs one load from a table that is vocab_size * 8 bytes. Both come from one step of the word2vec
+// random number generator: the top 32 bits choose the bucket by multiply-shift, the next 24 bits
+// are the coin.
+//
+// AliasDrawBatch() draws many samples at once. It computes every generator state directly from the
+// starting one with precomputed jump-ahead constants, so the states are independent and the loop
+// vectorizes, and the table loads can all be in flight together. The samples are the same ones
+// the generator would give one step at a time.
+
+#ifndef W2V_SAMPLER_H
+#define W2V_SAMPLER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ALIAS_BATCH 32
+#define ALIAS_COIN_BITS 24
+
+struct alias_entry {
+  unsigned int threshold;  // Keep the bucket if the coin is below this, out of 2^ALIAS_COIN_BITS
+  int alias;
+};
+
+struct alias_table {
+  struct alias_entry *entries;
+  long long size;
+  // State after k + 1 steps is jump_mul[k] * state + jump_add[k]
+  unsigned long long jump_mul[ALIAS_BATCH], jump_add[ALIAS_BATCH];
+};
+
+// Sets the jump-ahead constants, which only depend on the generator
+static inline void InitAliasJumps(struct alias_table *t) {
+  int a;
+  // One step of the generator in word2vec.c is r = (r + 11) * 25214903917
+  t->jump_mul[0] = 25214903917ULL;
+  t->jump_add[0] = 11 * 25214903917ULL;
+  for (a = 1; a < ALIAS_BATCH; a++) {
+    t->jump_mul[a] = t->jump_mul[a - 1] * t->jump_mul[0];
+    t->jump_add[a] = t->jump_add[a - 1] * t->jump_mul[0] + t->jump_add[0];
+  }
+}
+
+// Builds the table for P(i) proportional to weights[i], i < size
+static inline void InitAliasTable(struct alias_table *t, const double *weights, long long size) {
+  const unsigned int one = 1u << ALIAS_COIN_BITS;
+  long long a, s, l, num_small = 0, num_large = 0;
+  double sum = 0, *prob = (double *)malloc(size * sizeof(double));
+  long long *small = (long long *)malloc(size * sizeof(long long));
+  long long *large = (long long *)malloc(size * sizeof(long long));
+  t->entries = (struct alias_entry *)malloc(size * sizeof(struct alias_entry));
+  if ((prob == NULL) || (small == NULL) || (large == NULL) || (t->entries == NULL)) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  t->size = size;
+  for (a = 0; a < size; a++) sum += weights[a];
+  for (a = 0; a < size; a++) {
+    prob[a] = weights[a] * size / sum;
+    if (prob[a] < 1) small[num_small++] = a; else large[num_large++] = a;
+  }
+  // Fill every underfull bucket with the rest of its probability from an overfull one
+  while ((num_small > 0) && (num_large > 0)) {
+    s = small[--num_small];
+    l = large[--num_large];
+    t->entries[s].threshold = (unsigned int)(prob[s] * one + 0.5);
+    t->entries[s].alias = l;
+    prob[l] = (prob[l] + prob[s]) - 1;
+    if (prob[l] < 1) small[num_small++] = l; else large[num_large++] = l;
+  }
+  // What is left is full up to rounding
+  while (num_large > 0) {
+    l = large[--num_large];
+    t->entries[l].threshold = one;
+    t->entries[l].alias = l;
+  }
+  while (num_small > 0) {
+    s = small[--num_small];
+    t->entries[s].threshold = one;
+    t->entries[s].alias = s;
+  }
+  InitAliasJumps(t);
+  free(prob);
+  free(small);
+  free(large);
+}
+
+static inline void FreeAliasTable(struct alias_table *t) {
+  free(t->entries);
+}
+
+// Sample for one generator state
+static inline long long AliasDraw(const struct alias_table *t, unsigned long long r) {
+  long long bucket = ((r >> 32) * (unsigned long long)t->size) >> 32;
+  struct alias_entry e = t->entries[bucket];
+  return (((r >> (32 - ALIAS_COIN_BITS)) & ((1u << ALIAS_COIN_BITS) - 1)) < e.threshold) ? bucket : e.alias;
+}
+
+// Draws count samples into out and advances *random by count steps
+static inline void AliasDrawBatch(const struct alias_table *t, unsigned long long *random, int count, long long *out) {
+  unsigned long long r = *random, states[ALIAS_BATCH];
+  int a, n;
+  while (count > 0) {
+    n = (count < ALIAS_BATCH) ? count : ALIAS_BATCH;
+    for (a = 0; a < n; a++) states[a] = t->jump_mul[a] * r + t->jump_add[a];
+    for (a = 0; a < n; a++) out[a] = AliasDraw(t, states[a]);
+    r = states[n - 1];
+    out += n;
+    count -= n;
+  }
+  *random = r;
+}
+
+#endif
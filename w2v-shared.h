@@ -0,0 +1,151 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Training runs shared by several processes through a POSIX shared memory segment.
+//
+// The processes map the same weights and update them Hogwild style, exactly like the threads of
+// one process do, so each can run in its own container and be restarted on its own. Every process
+// has a slot in a worker table that it stamps with a heartbeat; the coordinator declares a worker
+// that stays silent for SHARED_TIMEOUT seconds dead and hands its unfinished work out again.
+// Locks are robust process-shared mutexes, so a process that dies holding one does not block the
+// others.
+
+#ifndef W2V_SHARED_H
+#define W2V_SHARED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHARED_MAX_WORKERS 64
+#define SHARED_TIMEOUT 30  // Seconds without a heartbeat before a worker counts as dead
+#define WORKER_FREE 0
+#define WORKER_ALIVE 1
+#define WORKER_DEAD 2      // Declared dead; its work is being handed out again
+
+struct shared_worker {
+  int state, pid;
+  long long heartbeat;  // CLOCK_MONOTONIC time of the last sign of life, in ns
+};
+
+static inline long long MonotonicNs() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static inline void InitSharedMutex(pthread_mutex_t *m) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(m, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+// Takes the lock, also when its last owner died holding it: the data it guards is kept
+// consistent at every store, so it only needs to be marked usable again
+static inline void LockShared(pthread_mutex_t *m) {
+  if (pthread_mutex_lock(m) == EOWNERDEAD) pthread_mutex_consistent(m);
+}
+
+static inline void UnlockShared(pthread_mutex_t *m) {
+  pthread_mutex_unlock(m);
+}
+
+// Creates the segment called name with bytes of zeroed memory, replacing any stale segment of that
+// name, and maps it. Returns NULL on failure.
+static inline void *CreateSharedMemory(const char *name, long long bytes) {
+  void *p;
+  int fd;
+  shm_unlink(name);
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) return NULL;
+  if (ftruncate(fd, bytes) != 0) {
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    shm_unlink(name);
+    return NULL;
+  }
+  return p;
+}
+
+// Maps the existing segment called name and sets *bytes to its size. Returns NULL if there is none.
+static inline void *AttachSharedMemory(const char *name, long long *bytes) {
+  struct stat st;
+  void *p;
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) return NULL;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+  *bytes = st.st_size;
+  p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return (p == MAP_FAILED) ? NULL : p;
+}
+
+// Takes a free slot of the worker table for this process; returns its index, or -1 if all are taken
+static inline int JoinWorkers(struct shared_worker *w, pthread_mutex_t *lock) {
+  int a;
+  LockShared(lock);
+  for (a = 0; a < SHARED_MAX_WORKERS; a++) if (w[a].state == WORKER_FREE) break;
+  if (a < SHARED_MAX_WORKERS) {
+    w[a].pid = getpid();
+    w[a].heartbeat = MonotonicNs();
+    __atomic_store_n(&w[a].state, WORKER_ALIVE, __ATOMIC_RELEASE);
+  }
+  UnlockShared(lock);
+  return (a < SHARED_MAX_WORKERS) ? a : -1;
+}
+
+static inline void Heartbeat(struct shared_worker *w) {
+  __atomic_store_n(&w->heartbeat, MonotonicNs(), __ATOMIC_RELAXED);
+}
+
+// Declares the first live worker other than self that has been silent for timeout seconds dead and
+// returns its index, or -1 if there is none. Once its work is given back, FreeWorker() lets a new
+// process have the slot.
+static inline int FindDeadWorker(struct shared_worker *w, int self, int timeout) {
+  long long now = MonotonicNs();
+  int a;
+  for (a = 0; a < SHARED_MAX_WORKERS; a++) {
+    if ((a == self) || (__atomic_load_n(&w[a].state, __ATOMIC_ACQUIRE) != WORKER_ALIVE)) continue;
+    if (now - __atomic_load_n(&w[a].heartbeat, __ATOMIC_RELAXED) < timeout * 1000000000LL) continue;
+    __atomic_store_n(&w[a].state, WORKER_DEAD, __ATOMIC_RELEASE);
+    return a;
+  }
+  return -1;
+}
+
+static inline void FreeWorker(struct shared_worker *w, pthread_mutex_t *lock) {
+  LockShared(lock);
+  __atomic_store_n(&w->state, WORKER_FREE, __ATOMIC_RELEASE);
+  UnlockShared(lock);
+}
+
+#endif
@@ -0,0 +1,129 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Multi-threaded merge sort with the interface of qsort().
+//
+// The array is cut into one run per thread and every thread sorts its run with qsort(); then
+// pairs of neighbouring runs are merged into a buffer of the same size, all pairs of a round in
+// parallel, until one run is left. With a comparison that is a total order the result is the same
+// as that of qsort(), for any number of threads.
+
+#ifndef W2V_SORT_H
+#define W2V_SORT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define SORT_MAX_THREADS 256
+#define SORT_MIN_RUN 4096  // Elements below which another thread does not pay off
+
+struct sort_task {
+  char *src, *dst;
+  long long begin, middle, end;  // Sort [begin, end) of src, or merge its sorted halves into dst
+  size_t size;
+  int (*cmp)(const void *, const void *);
+};
+
+static void *SortRunThread(void *arg) {
+  struct sort_task *t = (struct sort_task *)arg;
+  qsort(t->src + t->begin * t->size, t->end - t->begin, t->size, t->cmp);
+  return NULL;
+}
+
+// Merges [begin, middle) and [middle, end) of src into the same place of dst; ties take the left
+// run first, so the merge is stable
+static void *MergeRunsThread(void *arg) {
+  struct sort_task *t = (struct sort_task *)arg;
+  const size_t size = t->size;
+  char *a = t->src + t->begin * size, *a_end = t->src + t->middle * size;
+  char *b = a_end, *b_end = t->src + t->end * size, *d = t->dst + t->begin * size;
+  while ((a < a_end) && (b < b_end)) {
+    if (t->cmp(b, a) < 0) {
+      memcpy(d, b, size);
+      b += size;
+    } else {
+      memcpy(d, a, size);
+      a += size;
+    }
+    d += size;
+  }
+  memcpy(d, a, a_end - a);
+  memcpy(d + (a_end - a), b, b_end - b);
+  return NULL;
+}
+
+// Runs every task on its own thread, the last one on the caller's
+static inline void RunSortTasks(struct sort_task *tasks, int count, void *(*fn)(void *)) {
+  pthread_t pt[SORT_MAX_THREADS];
+  int a;
+  for (a = 0; a < count - 1; a++) pthread_create(&pt[a], NULL, fn, &tasks[a]);
+  if (count > 0) fn(&tasks[count - 1]);
+  for (a = 0; a < count - 1; a++) pthread_join(pt[a], NULL);
+}
+
+static inline void ParallelSort(void *base, long long n, size_t size, int (*cmp)(const void *, const void *), int threads) {
+  struct sort_task tasks[SORT_MAX_THREADS];
+  long long bounds[SORT_MAX_THREADS + 1];
+  char *src = (char *)base, *dst, *t;
+  int runs, a, count;
+  if (threads > SORT_MAX_THREADS) threads = SORT_MAX_THREADS;
+  if (threads > n / SORT_MIN_RUN) threads = n / SORT_MIN_RUN;
+  if (threads <= 1) {
+    qsort(base, n, size, cmp);
+    return;
+  }
+  dst = (char *)malloc(n * size);
+  if (dst == NULL) {
+    qsort(base, n, size, cmp);
+    return;
+  }
+  runs = threads;
+  for (a = 0; a <= runs; a++) bounds[a] = n * a / runs;
+  for (a = 0; a < runs; a++) {
+    tasks[a].src = src;
+    tasks[a].begin = bounds[a];
+    tasks[a].end = bounds[a + 1];
+    tasks[a].size = size;
+    tasks[a].cmp = cmp;
+  }
+  RunSortTasks(tasks, runs, SortRunThread);
+  while (runs > 1) {
+    count = 0;
+    for (a = 0; a < runs; a += 2) {
+      tasks[count].src = src;
+      tasks[count].dst = dst;
+      tasks[count].begin = bounds[a];
+      tasks[count].middle = bounds[a + 1];
+      tasks[count].end = (a + 1 < runs) ? bounds[a + 2] : bounds[a + 1];
+      tasks[count].size = size;
+      tasks[count].cmp = cmp;
+      bounds[count] = bounds[a];
+      count++;
+    }
+    bounds[count] = n;
+    RunSortTasks(tasks, count, MergeRunsThread);  // An odd run out merges with nothing: a copy
+    runs = count;
+    t = src;
+    src = dst;
+    dst = t;
+  }
+  if (src != (char *)base) {
+    memcpy(base, src, n * size);
+    free(src);
+  } else free(dst);
+}
+
+#endif
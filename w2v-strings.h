@@ -0,0 +1,105 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Arena for the strings of a vocabulary.
+//
+// Words are appended to one block that doubles when it is full, each with its terminating zero, and
+// a vocabulary entry holds the word's offset into the block instead of a pointer to its own
+// allocation. Adding a word costs no malloc(), the entries stay small, and since neither the entries
+// nor the block hold pointers, both can be written out with one write each and used as they are
+// when read back. Offsets stay valid when the block moves, pointers into it do not.
+//
+// Words that are dropped leave their bytes behind until CompactStrings() copies the remaining ones
+// into a new block, in the order of the entries: after sorting the vocabulary, the frequent words
+// end up next to each other.
+
+#ifndef W2V_STRINGS_H
+#define W2V_STRINGS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRINGS_MIN_CAPACITY 65536
+
+struct string_arena {
+  char *data;
+  long long size, capacity;  // Bytes in use and allocated
+};
+
+static inline void InitStringArena(struct string_arena *a, long long capacity) {
+  if (capacity < STRINGS_MIN_CAPACITY) capacity = STRINGS_MIN_CAPACITY;
+  a->size = 0;
+  a->capacity = capacity;
+  a->data = (char *)malloc(capacity);
+  if (a->data == NULL) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+}
+
+static inline void FreeStringArena(struct string_arena *a) {
+  free(a->data);
+  a->data = NULL;
+  a->size = a->capacity = 0;
+}
+
+// Drops all strings, keeping the memory
+static inline void ClearStringArena(struct string_arena *a) {
+  a->size = 0;
+}
+
+static inline char *ArenaString(const struct string_arena *a, long long offset) {
+  return a->data + offset;
+}
+
+// Appends the len bytes of word and a zero; returns their offset
+static inline long long ArenaAdd(struct string_arena *a, const char *word, int len) {
+  long long offset = a->size;
+  if (a->size + len + 1 > a->capacity) {
+    while (a->size + len + 1 > a->capacity) a->capacity *= 2;
+    a->data = (char *)realloc(a->data, a->capacity);
+    if (a->data == NULL) {
+      printf("Memory allocation failed\n");
+      exit(1);
+    }
+  }
+  memcpy(a->data + offset, word, len);
+  a->data[offset + len] = 0;
+  a->size += len + 1;
+  return offset;
+}
+
+// Keeps only the strings of the count entries at base, stride bytes apart, whose offsets are at
+// field bytes into each entry, and stores them in the order of the entries
+static inline void CompactStrings(struct string_arena *a, void *base, long long count, size_t stride, size_t field) {
+  struct string_arena fresh;
+  long long i, offset, bytes = 0;
+  char *e;
+  for (i = 0; i < count; i++) {
+    memcpy(&offset, (char *)base + i * stride + field, sizeof(offset));
+    bytes += strlen(a->data + offset) + 1;
+  }
+  InitStringArena(&fresh, bytes);
+  for (i = 0; i < count; i++) {
+    e = (char *)base + i * stride + field;
+    memcpy(&offset, e, sizeof(offset));
+    offset = ArenaAdd(&fresh, a->data + offset, strlen(a->data + offset));
+    memcpy(e, &offset, sizeof(offset));
+  }
+  FreeStringArena(a);
+  *a = fresh;
+}
+
+#endif
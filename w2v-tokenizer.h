@@ -0,0 +1,165 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Zero-copy tokenizer over a memory-mapped training file.
+//
+// Tokens are handed out as (pointer, length) into the mapping, together with their HashWord() from
+// w2v-hash.h, so a vocabulary lookup never has to copy or re-scan the word.
+// Word boundaries are space, tab, CR and newline, found 16/32 bytes at a time; every newline
+// produces one </s> token, like ReadWord() does. Differences from ReadWord(): a CR inside a word
+// splits it instead of being dropped, over-long words keep their first max_len bytes, and a last
+// word without a trailing newline is returned instead of being lost at EOF.
+
+#ifndef W2V_TOKENIZER_H
+#define W2V_TOKENIZER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "w2v-hash.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+struct token {
+  const char *word;         // Not NUL-terminated
+  int len;
+  unsigned long long hash;  // HashWord() of the token
+};
+
+struct token_reader {
+  const char *data;
+  long long size, pos;
+  int max_len;              // Longer words are truncated to this many bytes
+};
+
+// Maps a whole file read-only; returns NULL if it cannot be opened. Empty files map to "".
+static inline const char *MapFile(const char *file_name, long long *size) {
+  struct stat st;
+  void *data;
+  int fd = open(file_name, O_RDONLY);
+  if (fd < 0) return NULL;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+  *size = st.st_size;
+  if (st.st_size == 0) {
+    close(fd);
+    return "";
+  }
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return NULL;
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  return (const char *)data;
+}
+
+static inline void UnmapFile(const char *data, long long size) {
+  if (size > 0) munmap((void *)data, size);
+}
+
+static inline void InitTokenReader(struct token_reader *tr, const char *data, long long size, long long pos, int max_len) {
+  tr->data = data;
+  tr->size = size;
+  tr->pos = pos;
+  tr->max_len = max_len;
+}
+
+static inline int IsDelimiter(char ch) {
+  return (ch == ' ') || (ch == '\t') || (ch == '\n') || (ch == 13);
+}
+
+// Returns the position of the first delimiter at or after pos, or end
+static inline long long FindDelimiter(const char *data, long long pos, long long end) {
+#if defined(__AVX2__)
+  const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+  const __m256i nl = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8(13);
+  while (pos + 32 <= end) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(data + pos));
+    __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)));
+    unsigned int mask = _mm256_movemask_epi8(m);
+    if (mask) return pos + __builtin_ctz(mask);
+    pos += 32;
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i sp16 = _mm_set1_epi8(' '), tab16 = _mm_set1_epi8('\t');
+  const __m128i nl16 = _mm_set1_epi8('\n'), cr16 = _mm_set1_epi8(13);
+  while (pos + 16 <= end) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(data + pos));
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp16), _mm_cmpeq_epi8(v, tab16)),
+                             _mm_or_si128(_mm_cmpeq_epi8(v, nl16), _mm_cmpeq_epi8(v, cr16)));
+    unsigned int mask = _mm_movemask_epi8(m);
+    if (mask) return pos + __builtin_ctz(mask);
+    pos += 16;
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t sp16 = vdupq_n_u8(' '), tab16 = vdupq_n_u8('\t');
+  const uint8x16_t nl16 = vdupq_n_u8('\n'), cr16 = vdupq_n_u8(13);
+  while (pos + 16 <= end) {
+    uint8x16_t v = vld1q_u8((const uint8_t *)(data + pos));
+    uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, sp16), vceqq_u8(v, tab16)), vorrq_u8(vceqq_u8(v, nl16), vceqq_u8(v, cr16)));
+    // Narrow to 4 bits per byte to get a scalar mask
+    unsigned long long mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+    if (mask) return pos + (__builtin_ctzll(mask) >> 2);
+    pos += 16;
+  }
+#endif
+  while ((pos < end) && !IsDelimiter(data[pos])) pos++;
+  return pos;
+}
+
+// Reads the next token; returns 0 at the end of the data
+static inline int ReadToken(struct token_reader *tr, struct token *t) {
+  const char *data = tr->data;
+  long long pos = tr->pos, end;
+  char ch;
+  while (pos < tr->size) {
+    ch = data[pos];
+    if (ch == '\n') {
+      tr->pos = pos + 1;
+      t->word = "</s>";
+      t->len = 4;
+      t->hash = HashWord("</s>", 4);
+      return 1;
+    }
+    if (!IsDelimiter(ch)) break;
+    pos++;
+  }
+  if (pos >= tr->size) {
+    tr->pos = pos;
+    return 0;
+  }
+  // The delimiter itself is left in place, so a newline still yields </s> on the next call
+  end = FindDelimiter(data, pos + 1, tr->size);
+  tr->pos = end;
+  t->word = data + pos;
+  t->len = (end - pos > tr->max_len) ? tr->max_len : end - pos;
+  t->hash = HashWord(t->word, t->len);
+  return 1;
+}
+
+#endif
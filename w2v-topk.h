@@ -0,0 +1,153 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Word counting in a fixed amount of memory: the Space-Saving algorithm (Metwally et al., 2005).
+//
+// There is a fixed number m of counters. A word that has one is counted there; a word that has none
+// takes the counter with the smallest count, min, and continues from min + 1, recording min as its
+// possible error. After n words every count is at most n / m too high, and every word that occurred
+// more than n / m times has a counter, so the frequent words and their counts come out right while
+// the rare ones compete for the rest. The counters are a min-heap on the count; a word's counter is
+// found through a w2v-hash.h table that never grows. Words are not copied: they point into the text,
+// which has to stay mapped as long as the summary is used.
+
+#ifndef W2V_TOPK_H
+#define W2V_TOPK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "w2v-hash.h"
+
+struct topk_counter {
+  const char *word;
+  int len;
+  int heap;                 // Position in the heap
+  unsigned long long hash;
+  long long count, error;   // The true count is in [count - error, count]
+};
+
+struct topk_summary {
+  struct topk_counter *counters;
+  int *heap;                // Counters, by count; heap[0] has the smallest
+  long long size, capacity, words;  // words: all words counted
+  struct word_hash hash;
+};
+
+// Bytes of a summary of capacity counters, its hash table included
+static inline long long TopKBytes(long long capacity) {
+  long long slots = 1LL << HASH_MIN_BITS;
+  while (slots * 3 < capacity * 4) slots *= 2;
+  return capacity * (sizeof(struct topk_counter) + sizeof(int)) + slots * sizeof(struct hash_slot);
+}
+
+// The most counters that fit into bytes of memory
+static inline long long TopKCapacity(long long bytes) {
+  long long lo = 0, hi = bytes / (sizeof(struct topk_counter) + sizeof(int)), mid;
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (TopKBytes(mid) <= bytes) lo = mid; else hi = mid - 1;
+  }
+  return lo;
+}
+
+static inline void InitTopK(struct topk_summary *s, long long capacity) {
+  s->size = s->words = 0;
+  s->capacity = capacity;
+  s->counters = (struct topk_counter *)malloc(capacity * sizeof(struct topk_counter));
+  s->heap = (int *)malloc(capacity * sizeof(int));
+  if ((s->counters == NULL) || (s->heap == NULL)) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  InitWordHash(&s->hash, capacity, NULL, NULL);
+}
+
+static inline void FreeTopK(struct topk_summary *s) {
+  free(s->counters);
+  free(s->heap);
+  FreeWordHash(&s->hash);
+}
+
+static int SameTopKWord(const void *ctx, int index, const char *word, int len) {
+  const struct topk_counter *c = &((const struct topk_summary *)ctx)->counters[index];
+  return (c->len == len) && !memcmp(c->word, word, len);
+}
+
+// Moves the counter at heap position pos down after its count grew
+static inline void TopKSiftDown(struct topk_summary *s, long long pos) {
+  int i = s->heap[pos], child;
+  long long c, count = s->counters[i].count;
+  while ((c = 2 * pos + 1) < s->size) {
+    if ((c + 1 < s->size) && (s->counters[s->heap[c + 1]].count < s->counters[s->heap[c]].count)) c++;
+    child = s->heap[c];
+    if (s->counters[child].count >= count) break;
+    s->heap[pos] = child;
+    s->counters[child].heap = pos;
+    pos = c;
+  }
+  s->heap[pos] = i;
+  s->counters[i].heap = pos;
+}
+
+// Moves the counter at heap position pos up, for a new one at the end
+static inline void TopKSiftUp(struct topk_summary *s, long long pos) {
+  int i = s->heap[pos], parent;
+  long long count = s->counters[i].count;
+  while (pos > 0) {
+    parent = s->heap[(pos - 1) / 2];
+    if (s->counters[parent].count <= count) break;
+    s->heap[pos] = parent;
+    s->counters[parent].heap = pos;
+    pos = (pos - 1) / 2;
+  }
+  s->heap[pos] = i;
+  s->counters[i].heap = pos;
+}
+
+// Counts one occurrence of the len bytes of word, whose HashWord() is hash
+static inline void TopKAdd(struct topk_summary *s, const char *word, int len, unsigned long long hash) {
+  struct topk_counter *c;
+  int i = WordHashFind(&s->hash, hash, word, len, SameTopKWord, s);
+  s->words++;
+  if (i != -1) {
+    s->counters[i].count++;
+    TopKSiftDown(s, s->counters[i].heap);
+    return;
+  }
+  if (s->size < s->capacity) {
+    i = s->size++;
+    c = &s->counters[i];
+    c->count = 1;
+    c->error = 0;
+    s->heap[i] = i;
+    TopKSiftUp(s, i);
+  } else {
+    i = s->heap[0];
+    c = &s->counters[i];
+    WordHashRemove(&s->hash, c->hash, i);
+    c->error = c->count++;
+    TopKSiftDown(s, 0);
+  }
+  c->word = word;
+  c->len = len;
+  c->hash = hash;
+  WordHashInsert(&s->hash, hash, i);
+}
+
+// Bound on the error of every count, and on the count of every word without a counter
+static inline long long TopKMaxError(const struct topk_summary *s) {
+  return (s->size < s->capacity) ? 0 : s->counters[s->heap[0]].count;
+}
+
+#endif
@@ -18,49 +18,49 @@
 #include <string.h>
 #include <math.h>
 #include <pthread.h>
+#include "w2v-hash.h"
+#include "w2v-strings.h"
 
 #define MAX_STRING 60
-#define MAX_SHORT_WORD 12 
 
-const int vocab_hash_size = 536870912; // Maximum 2^29 entries in the vocabulary
-//const int vocab_hash_size = 500000000; 
+// ReduceVocab() prunes rare words and bigrams whenever the vocabulary grows beyond this many
+const long long vocab_limit = 375809638;
 
 typedef float real;                    // Precision of float numbers
 
+// A word is an offset into vocab_strings, so the entries hold no pointers
 struct __attribute__((packed)) vocab_word {
-  union __attribute__((packed)) {
-	char *word;
-	char shortword[MAX_SHORT_WORD];
-  } w;
+  long long word;
   unsigned int cn;
 };
 
-const unsigned int SHORT_WORD = (1 << 31); 
 const unsigned int max_count = ((unsigned int)(1 << 31) - 1); 
 struct vocab_word *vocab;
+struct string_arena vocab_strings;
 
-inline char * GetWordPtr(struct vocab_word *word)
+static inline char * GetWordPtr(struct vocab_word *word)
 {
-	return (word->cn & SHORT_WORD) ? word->w.shortword : word->w.word; 
+	return ArenaString(&vocab_strings, word->word);
 }
 
-inline char * GetWordPtrI(int index)
+static inline char * GetWordPtrI(int index)
 {
 	return GetWordPtr(&vocab[index]);
 }
 
-inline int GetWordUsage(const void *w)
+static inline int GetWordUsage(const void *w)
 { 
-	return ((struct vocab_word *)w)->cn & max_count;
+	return ((struct vocab_word *)w)->cn;
 }
 
-inline int GetWordUsageI(const int i)
+static inline int GetWordUsageI(const int i)
 { 
-	return vocab[i].cn & max_count;
+	return vocab[i].cn;
 }
 
 char train_file[MAX_STRING], output_file[MAX_STRING];
-int debug_mode = 2, min_count = 5, *vocab_hash, min_reduce = 1;
+int debug_mode = 2, min_count = 5, min_reduce = 1;
+struct word_hash vocab_hash;
 long long vocab_max_size = 32768, vocab_size_increment = 32768, vocab_size = 0;
 long long train_words = 0;
 real threshold = 100;
@@ -90,24 +90,15 @@ void ReadWord(char *word, FILE *fin) {
   word[a] = 0;
 }
 
-// Returns hash value of a word
-int GetWordHash(char *word) {
-  unsigned long long a, hash = 1;
-  for (a = 0; a < strlen(word); a++) hash = hash * 257 + word[a];
-  hash = hash % vocab_hash_size;
-  return hash;
+static int SameVocabWord(const void *ctx, int index, const char *word, int len) {
+  const char *w = GetWordPtrI(index);
+  return !strncmp(word, w, len) && (w[len] == 0);
 }
 
 // Returns position of a word in the vocabulary; if the word is not found, returns -1
 int SearchVocab(char *word) {
-  unsigned int hash = GetWordHash(word);
-  while (1) {
-    if (vocab_hash[hash] == -1) return -1;
-//    printf("%x %d %x %p %s\n", hash, vocab_hash[hash], vocab[vocab_hash[hash]].cn, GetWordPtrI(vocab_hash[hash]), GetWordPtrI(vocab_hash[hash]));
-    if (!strncmp(word, GetWordPtrI(vocab_hash[hash]), MAX_STRING)) return vocab_hash[hash];
-    hash = (hash + 1) % vocab_hash_size;
-  }
-  return -1;
+  int len = strlen(word);
+  return WordHashFind(&vocab_hash, HashWord(word, len), word, len, SameVocabWord, NULL);
 }
 
 // Reads a word and returns its index in the vocabulary
@@ -120,22 +111,11 @@ int ReadWordIndex(FILE *fin) {
 
 // Adds a word to the vocabulary
 int AddWordToVocab(char *word) {
-	unsigned int hash, length = strlen(word) + 1;
-	char *word_addr = NULL;
-
-	if (length <= MAX_SHORT_WORD) {
-		vocab[vocab_size].cn = 1 | SHORT_WORD;
-		word_addr = vocab[vocab_size].w.shortword;
-//		printf("short word %d %s\n", vocab_size, word);
-	} else { 
-		if (length > MAX_STRING) length = MAX_STRING;
-		vocab[vocab_size].cn = 1;
-		vocab[vocab_size].w.word = (char *)calloc(length, sizeof(char));
-		word_addr = vocab[vocab_size].w.word;
-//		printf("long word %d %s\n", vocab_size, word);
-	}
-		
-	strncpy(word_addr, word, length);
+	unsigned int length = strlen(word) + 1;
+
+	if (length > MAX_STRING) length = MAX_STRING;
+	vocab[vocab_size].cn = 1;
+	vocab[vocab_size].word = ArenaAdd(&vocab_strings, word, length - 1);
 		
 	// Reallocate memory if needed
 	if (vocab_size + 3 >= vocab_max_size) {
@@ -143,10 +123,7 @@ int AddWordToVocab(char *word) {
 		vocab=(struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
 	}
 
-	// Find an empty hash spot.
-	hash = GetWordHash(word);
-	while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-	vocab_hash[hash]=vocab_size;
+	WordHashInsert(&vocab_hash, HashWord(word, length - 1), vocab_size);
 
 	return vocab_size++; // post-increment, won't actually go up until return value taken
 }
@@ -160,26 +137,23 @@ int VocabCompare(const void *a, const void *b) {
 // Reduces the vocabulary by removing infrequent tokens
 void ReduceVocab(int min_usage) {
 	int a, new_vocab_size = 0;
-	unsigned int hash;
+	char *w;
 
 	for (a = 0; a < vocab_size; a++) { 
 		if (GetWordUsageI(a) > min_usage) {
-			vocab[new_vocab_size].cn = vocab[a].cn;
-			if (a != new_vocab_size) memcpy(&vocab[new_vocab_size].w, &vocab[a].w, sizeof(vocab[a].w));
+			if (a != new_vocab_size) memcpy(&vocab[new_vocab_size], &vocab[a], sizeof(struct vocab_word));
 			new_vocab_size++;
-		} else {
-			if (!(vocab[a].cn & SHORT_WORD)) free(vocab[a].w.word);
 		}
 	}
 
 	vocab_size = new_vocab_size;
+	CompactStrings(&vocab_strings, vocab, vocab_size, sizeof(struct vocab_word), offsetof(struct vocab_word, word));
 
 	// Recompute hashes, since multiple words may have hashed the same way 
-	for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
+	ResetWordHash(&vocab_hash, vocab_size);
 	for (a = 0; a < vocab_size; a++) {
-		hash = GetWordHash(GetWordPtrI(a));
-		while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-		vocab_hash[hash] = a;
+		w = GetWordPtrI(a);
+		WordHashInsert(&vocab_hash, HashWord(w, strlen(w)), a);
 	}
 	fflush(stdout);
 }
@@ -193,12 +167,13 @@ void SortVocab() {
 void LearnVocabFromTrainFile() {
   char word[MAX_STRING], last_word[MAX_STRING], bigram_word[MAX_STRING * 2];
   FILE *fin;
-  long long a, i, start = 1;
+  long long i, start = 1;
 
   strcpy(word, "");
   strcpy(last_word, "");
 
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
+  ResetWordHash(&vocab_hash, 0);
+  ClearStringArena(&vocab_strings);
   fin = fopen(train_file, "rb");
   if (fin == NULL) {
     printf("ERROR: training data file not found!\n");
@@ -221,7 +196,7 @@ void LearnVocabFromTrainFile() {
     i = SearchVocab(word);
     //printf("%d %s\n", i, word);
     if (i == -1) {
-      a = AddWordToVocab(word);
+      AddWordToVocab(word);
     } else {
 	if (GetWordUsageI(i) < max_count) vocab[i].cn++;
     }
@@ -231,11 +206,11 @@ void LearnVocabFromTrainFile() {
     strcpy(last_word, word);
     i = SearchVocab(bigram_word);
     if (i == -1) {
-      a = AddWordToVocab(bigram_word);
+      AddWordToVocab(bigram_word);
     } else {
 	if (GetWordUsageI(i) < max_count) vocab[i].cn++;
     }
-    if (vocab_size > vocab_hash_size * 0.7) ReduceVocab(min_reduce++);
+    if (vocab_size > vocab_limit) ReduceVocab(min_reduce++);
   }
   SortVocab();
   ReduceVocab(min_count);
@@ -329,7 +304,8 @@ int main(int argc, char **argv) {
   if ((i = ArgPos((char *)"-min-count", argc, argv)) > 0) min_count = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-threshold", argc, argv)) > 0) threshold = atof(argv[i + 1]);
   vocab = (struct vocab_word *)calloc(vocab_max_size, sizeof(struct vocab_word));
-  vocab_hash = (int *)calloc(vocab_hash_size, sizeof(int));
+  InitWordHash(&vocab_hash, 0, NULL, NULL);
+  InitStringArena(&vocab_strings, 0);
   TrainModel();
   return 0;
 }
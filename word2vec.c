@@ -12,70 +12,98 @@
 //  See the License for the specific language governing permissions and
 //  limitations under the License.
 
+#define _GNU_SOURCE  // CPU affinity for -numa
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "w2v-encoded.h"
+#include "w2v-tokenizer.h"
+#include "w2v-queue.h"
+#include "w2v-kernels.h"
+#include "w2v-sampler.h"
+#include "w2v-half.h"
+#include "w2v-numa.h"
+#include "w2v-hugepages.h"
+#include "w2v-shared.h"
+#include "w2v-chunks.h"
+#include "w2v-sort.h"
+#include "w2v-hash.h"
+#include "w2v-topk.h"
+#include "w2v-strings.h"
 
 #define MAX_STRING 100
-#define EXP_TABLE_SIZE 512 
-#define MAX_EXP 6
 #define MAX_SENTENCE_LENGTH 1000
 #define MAX_CODE_LENGTH 40
+#define BATCH_WORDS 4096
+#define BATCH_SENTENCES 256
 
-const int vocab_hash_size = 33554432;  // Maximum 33.5M * 0.7 = ~23M words in the vocabulary
+// ReduceVocab() prunes rare words whenever the vocabulary grows beyond this many words
+const long long vocab_limit = 23488102;
+long long vocab_memory = 0;  // -vocab-memory: bytes for counting the vocabulary with w2v-topk.h
 
-typedef float real;                    // Precision of float numbers
+typedef float real;                    // Precision of float numbers; the kernels in w2v-kernels.h assume float
 
-#define MAX_SHORT_WORD 24
-
-struct __attribute__((packed)) vocab_word {
-  union __attribute__((packed)) {
-	char *word;
-	char shortword[MAX_SHORT_WORD];
-  } w;
+// A word is an offset into vocab_strings, so the entries hold no pointers
+struct vocab_word {
+  long long word;
   long long count;
 };
 
-const long long SHORT_WORD = ((long long)1 << 62); 
-const long long max_count = (((long long)1 << 62) - 1); 
 struct vocab_word *vocab;
+struct string_arena vocab_strings;
 
-inline char * GetWordPtr(struct vocab_word *word)
+static inline char * GetWordPtr(struct vocab_word *word)
 {
-	return (word->count & SHORT_WORD) ? word->w.shortword : word->w.word; 
+	return ArenaString(&vocab_strings, word->word);
 }
 
-inline char * GetWordPtrI(int index)
+static inline char * GetWordPtrI(int index)
 {
 	return GetWordPtr(&vocab[index]);
 }
 
-inline long long GetWordUsage(const void *w)
+static inline long long GetWordUsage(const void *w)
 { 
-	return ((struct vocab_word *)w)->count & max_count;
+	return ((struct vocab_word *)w)->count;
 }
 
-inline long long GetWordUsageI(const int i)
+static inline long long GetWordUsageI(const int i)
 { 
-	return vocab[i].count & max_count;
+	return vocab[i].count;
 }
 
-inline int ReadWordIndex(FILE *fin);
-
+// Huffman code of a word: the inner nodes on its path from the root are code_points[points] up to
+// the points of the next word, and bit d of code is the branch taken at node d
 struct vocab_code {
-	char codelen;
-	int point[MAX_CODE_LENGTH];
-	char code[MAX_CODE_LENGTH];
+	long long points;
+	unsigned long long code;
 };
 
 char train_file[MAX_STRING], output_file[MAX_STRING];
-char save_vocab_file[MAX_STRING], read_vocab_file[MAX_STRING];
+char save_vocab_file[MAX_STRING], read_vocab_file[MAX_STRING], train_encoded_file[MAX_STRING];
+// Continued training: the vectors, output weights and vocabulary of an earlier run
+char init_vectors_file[MAX_STRING], init_context_file[MAX_STRING], init_vocab_file[MAX_STRING];
+char save_context_file[MAX_STRING];
 struct vocab_word *vocab;
-struct vocab_code *vocab_codes;
+struct vocab_code *vocab_codes;  // vocab_size + 1 entries, the last one ends the paths
+int *code_points;
+
+static inline long long CodeLength(long long word)
+{
+	return vocab_codes[word + 1].points - vocab_codes[word].points;
+}
 int binary = 0, cbow = 1, debug_mode = 2, window = 5, min_count = 5, num_threads = 12, min_reduce = 1;
-int *vocab_hash;
+struct word_hash vocab_hash;
 long long vocab_max_size = 1000, vocab_size = 0;
 // Making layer1_size const might drastically decrease # of instructions issued...
 //#define CONST_LAYER1 256
@@ -86,31 +114,137 @@ const long long layer1_size = CONST_LAYER1;
 long long layer1_size = 256;
 #endif
 long long train_words = 0, word_count_actual = 0, iter = 5, file_size = 0, classes = 0;
+// Sum of the vocabulary counts, which subsampling takes the word frequencies from: train_words,
+// plus the counts -init-vocab merged in
+long long vocab_words = 0, init_words = 0;
 real alpha = 0.025, starting_alpha, sample = 1e-3;
-real *syn0, *syn1, *syn1neg, *expTable;
+real *syn0, *syn1, *syn1neg;
+// -storage bf16/fp16 keeps syn0 and syn1neg here instead, 16 bits per weight
+unsigned short *syn0_half, *syn1neg_half;
+unsigned char *frozen = NULL;  // -freeze: rows of syn0 that training leaves as -init-vectors set them
+int storage = STORAGE_FP32, stochastic_round = 0;
+// -numa: weight pages interleaved over the nodes and threads pinned; trainer threads and the
+// weight rows they read or write are counted per node for the report at the end
+int numa = 0;
+struct numa_topology topology;
+long long node_threads[NUMA_MAX_NODES], node_rows[NUMA_MAX_NODES];
+int huge_pages = HUGE_THP;  // Page kind for the weights, vocab_hash and the unigram table
+char kernel_name[MAX_STRING], storage_name[MAX_STRING], huge_pages_name[MAX_STRING];
+// Vector kernels, picked from w2v-kernels.h for this CPU at startup
+real (*DoMAC)(const int n, const real *a, const real *b);
+void (*DoAdd)(const int n, real *a, const real *b);
+void (*DoMAC1)(const int n, real *out, real c, const real *b);
+void (*DoUpdate)(const int n, const real *x, real *row, real *err, real g);
+void (*DoSigmoidGrad)(const int n, real *f, const real *label, real alpha);
+unsigned char *encoded_data = NULL;  // Token stream of -train-encoded, file_size bytes long
+const char *train_data = NULL;       // Mapped -train text, file_size bytes long
 clock_t start;
 
-int hs = 0, negative = 5;
-//const int table_size = 1e8;
-const int table_size = 134217728; // 2^27
-int *table;
-
+// Pipeline mode: sentences read and subsampled by reader threads, queued for the trainers
+struct sentence_batch {
+  long long count, words;  // words counts everything read for the batch, subsampled words included
+  long long chunk;         // Entry of the chunk schedule the sentences come from
+  long long offset[BATCH_SENTENCES + 1];
+  long long sen[BATCH_WORDS + MAX_SENTENCE_LENGTH];
+};
+int num_readers = 0, readers_running;
+// The training data in sentence-aligned chunks, handed out to the threads that read it
+struct chunk_schedule schedule;
+long long num_chunks = 0;
+struct ring full_batches, free_batches;
+long long reader_blocked = 0, reader_pushes = 0, trainer_starved = 0, trainer_pops = 0, queue_occupancy = 0;
+
+// -checkpoint: the weights and the progress through the schedule, written every checkpoint_every
+// minutes by a forked copy of the process while training goes on; -resume continues from them.
+// The header is followed by the num_finished chunks finished after the first chunks_done, then
+// the weights.
+#define CHECKPOINT_MAGIC "W2VCKP03"
+struct checkpoint_header {
+  char magic[8];
+  unsigned long long vocab_checksum;
+  long long vocab_size, layer1_size, file_size, cbow, window, hs, negative, batch_neg, storage;
+  long long train_words, init_words;  // The vocabulary of the checkpoint has the -init-vocab counts merged in
+  long long iter, num_chunks, chunks_done, words_done, num_finished;  // The schedule and how much of it is finished
+  double sample, starting_alpha;
+};
+char checkpoint_dir[MAX_STRING];
+real checkpoint_every = 60;
+int resume = 0, trainers_running;
+pid_t checkpoint_pid = 0;
+long long checkpoint_chunks = 0;
+struct finished_chunk *checkpoint_finished;
+struct checkpoint_header resume_header;
+struct finished_chunk *resume_finished;
+
+// -shm: the weights, the chunk schedule and a table of worker processes in a shared memory segment,
+// which processes started with -attach map to train the same model. The creating process is the
+// coordinator: it owns the vocabulary and the schedule and writes the result.
+#define SHARED_MAGIC "W2VSHM01"
+struct shared_run {
+  char magic[8];
+  int ready, complete;
+  pthread_mutex_t lock;  // Guards the worker table
+  struct shared_worker workers[SHARED_MAX_WORKERS];
+  long long word_count;  // word_count_actual of the whole run
+  // The settings every process trains with
+  long long vocab_size, layer1_size, train_words, vocab_words, file_size, iter, num_chunks, min_count;
+  long long cbow, window, hs, negative, batch_neg, storage, stochastic_round;
+  double sample, starting_alpha;
+  unsigned long long vocab_checksum;
+  char train_file[MAX_STRING], train_encoded_file[MAX_STRING];
+  // Where the parts are, from the start of the segment
+  long long vocab_offset, vocab_bytes, schedule_offset, syn0_offset, syn1_offset, syn1neg_offset, bytes;
+};
+char shm_name[MAX_STRING], attach_name[MAX_STRING];
+struct shared_run *shared = NULL;
+int worker_id = 0, worker_timeout = SHARED_TIMEOUT;
+
+// -vocab-cache: the vocabulary with its hash table, Huffman codes and unigram table in one binary
+// file, written by the first run and mapped by every later one that would build the same vocabulary
+#define VOCAB_CACHE_MAGIC "W2VVOC01"
+#define VOCAB_CACHE_KEY 512
+struct vocab_cache_header {
+  char magic[8];
+  char key[VOCAB_CACHE_KEY];  // What the vocabulary was built from, see VocabCacheKey()
+  long long vocab_size, train_words, vocab_words, init_words, hash_bits, hash_count, strings_bytes, points;
+  // Where the parts are, from the start of the file
+  long long vocab_offset, strings_offset, hash_offset, codes_offset, points_offset, unigram_offset, bytes;
+};
+char vocab_cache_file[MAX_STRING];
+int vocab_tables = 0;  // The Huffman codes and the unigram table are there already
+
+int hs = 0, negative = 5, batch_neg = 0, freeze = 0;
+int prefetch = 2;  // How many positions / negative sets ahead their rows are prefetched, 0 for none
+// -hot-rows: every thread keeps its own fp32 replicas of the output rows of the hot_rows most
+// frequent words and merges what it changed into syn1neg every hot_sync words it trains on.
+// Totals of the output row updates, those that went to a replica, and the shared rows the merges
+// wrote, for the report.
+long long hot_rows = 0, hot_sync = 1000, output_updates = 0, hot_updates = 0, hot_merged = 0;
+struct alias_table unigram;
+
+// Negative samples are drawn with probability proportional to count^0.75
 void InitUnigramTable() {
-  int a, i;
-  double train_words_pow = 0;
-  double d1, power = 0.75;
-  printf("table size %d\n", table_size);
-  table = (int *)malloc(table_size * sizeof(int));
-  for (a = 0; a < vocab_size; a++) train_words_pow += pow(GetWordUsageI(a), power);
-  i = 0;
-  d1 = pow(GetWordUsageI(i), power) / train_words_pow;
-  for (a = 0; a < table_size; a++) {
-    table[a] = i;
-    if (a / (double)table_size > d1) {
-      i++;
-      d1 += pow(GetWordUsageI(i), power) / train_words_pow;
-    }
-    if (i >= vocab_size) i = vocab_size - 1;
+  long long a;
+  struct alias_entry *entries;
+  double power = 0.75, *weights = (double *)malloc(vocab_size * sizeof(double));
+  for (a = 0; a < vocab_size; a++) weights[a] = pow(GetWordUsageI(a), power);
+  InitAliasTable(&unigram, weights, vocab_size);
+  free(weights);
+  // Every draw is a random row of the table; move it to huge pages
+  entries = (struct alias_entry *)AllocHuge(vocab_size * sizeof(struct alias_entry), huge_pages, "Unigram table", debug_mode > 1);
+  memcpy(entries, unigram.entries, vocab_size * sizeof(struct alias_entry));
+  FreeAliasTable(&unigram);
+  unigram.entries = entries;
+  printf("Unigram alias table: %lld KB\n", vocab_size * (long long)sizeof(struct alias_entry) / 1024);
+}
+
+// Fills negs[0..negative) with negative samples; </s> is replaced by a random word
+static inline void DrawNegatives(long long *negs, unsigned long long *random) {
+  int d;
+  AliasDrawBatch(&unigram, random, negative, negs);
+  for (d = 0; d < negative; d++) if (negs[d] == 0) {
+    *random = (*random + 11) * (unsigned long long)25214903917;
+    negs[d] = *random % (vocab_size - 1) + 1;
   }
 }
 
@@ -137,52 +271,60 @@ void ReadWord(char *word, FILE *fin) {
   word[a] = 0;
 }
 
-// Returns hash value of a word
-inline int GetWordHash(char *word) {
-  unsigned long long a, hash = 0;
-  for (a = 0; a < strlen(word); a++) hash = hash * 257 + word[a];
-  hash = hash % vocab_hash_size;
-  return hash;
+static int SameVocabWord(const void *ctx, int index, const char *word, int len) {
+  const char *w = GetWordPtrI(index);
+  return !strncmp(word, w, len) && (w[len] == 0);
 }
 
 // Returns position of a word in the vocabulary; if the word is not found, returns -1
-inline int SearchVocab(char *word) {
-  unsigned int hash = GetWordHash(word);
-  while (1) {
-    if (vocab_hash[hash] == -1) return -1;
-    if (!strcmp(word, GetWordPtrI(vocab_hash[hash]))) return vocab_hash[hash];
-    hash = (hash + 1) % vocab_hash_size;
+static inline int SearchVocab(char *word) {
+  int len = strlen(word);
+  return WordHashFind(&vocab_hash, HashWord(word, len), word, len, SameVocabWord, NULL);
+}
+
+// Same as SearchVocab, for a token that is not NUL-terminated
+static inline int SearchToken(struct token *t) {
+  return WordHashFind(&vocab_hash, t->hash, t->word, t->len, SameVocabWord, NULL);
+}
+
+// Empties vocab_hash, sized for the vocabulary as it is, and adds every word again
+void RebuildVocabHash() {
+  long long a;
+  char *w;
+  ResetWordHash(&vocab_hash, vocab_size);
+  for (a = 0; a < vocab_size; a++) {
+    w = GetWordPtrI(a);
+    WordHashInsert(&vocab_hash, HashWord(w, strlen(w)), a);
   }
-  return -1;
 }
 
-// Reads a word and returns its index in the vocabulary
-int ReadWordIndex(FILE *fin) {
-  char word[MAX_STRING];
-  ReadWord(word, fin);
-  if (feof(fin)) return -1;
-  return SearchVocab(word);
+// Empties the vocabulary
+void ClearVocab() {
+  ResetWordHash(&vocab_hash, 0);
+  ClearStringArena(&vocab_strings);
+  vocab_size = 0;
+}
+
+static void *AllocVocabHash(long long bytes) {
+  return AllocHuge(bytes, huge_pages, "vocab_hash", 0);
+}
+
+// Maps the training text once; the vocabulary pass and all training threads share it
+void MapTrainFile() {
+  train_data = MapFile(train_file, &file_size);
+  if (train_data == NULL) {
+    printf("ERROR: training data file not found!\n");
+    exit(1);
+  }
 }
 
 // Adds a word to the vocabulary
 int AddWordToVocab(char *word) {
-	unsigned int hash, length = strlen(word) + 1;
-	char *word_addr = NULL;
-
-	if (length < (MAX_SHORT_WORD - 1)) {
-		vocab[vocab_size].count = 1 | SHORT_WORD;
-		word_addr = vocab[vocab_size].w.shortword;
-//		printf("short word %d %s\n", vocab_size, word);
-	} else { 
-		if (length > MAX_STRING) length = MAX_STRING;
-		vocab[vocab_size].count = 1;
-		vocab[vocab_size].w.word = (char *)calloc(length, sizeof(char));
-		word_addr = vocab[vocab_size].w.word;
-//		printf("long word %d %s\n", vocab_size, word);
-	}
-		
-	strncpy(word_addr, word, length);
-	word_addr[length - 1] = 0;
+	unsigned int length = strlen(word) + 1;
+
+	if (length > MAX_STRING) length = MAX_STRING;
+	vocab[vocab_size].count = 1;
+	vocab[vocab_size].word = ArenaAdd(&vocab_strings, word, length - 1);
 		
 	// Reallocate memory if needed
 	if (vocab_size + 3 >= vocab_max_size) {
@@ -190,41 +332,38 @@ int AddWordToVocab(char *word) {
 		vocab = (struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
 	}
 
-	// Find an empty hash spot.
-	hash = GetWordHash(word);
-	while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-	vocab_hash[hash]=vocab_size;
+	WordHashInsert(&vocab_hash, HashWord(word, length - 1), vocab_size);
 
 	return vocab_size++; // post-increment, won't actually go up until return value taken
 }
 
-// Used later for sorting by word counts
+// Used later for sorting by word counts; ties are broken by the word so the order is
+// reproducible, which w2v-encode relies on to assign the same indices
 int VocabCompare(const void *a, const void *b) {
-    return GetWordUsage(b) - GetWordUsage(a);
+  long long ca = GetWordUsage(a), cb = GetWordUsage(b);
+  if (ca != cb) return (cb > ca) ? 1 : -1;
+  return strcmp(GetWordPtr((struct vocab_word *)a), GetWordPtr((struct vocab_word *)b));
 }
 
 // Sorts the vocabulary by frequency using word counts
 void SortVocab() {
   int a, size;
-  unsigned int hash;
   // Sort the vocabulary and keep </s> at the first position
-  qsort(&vocab[1], vocab_size - 1, sizeof(struct vocab_word), VocabCompare);
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
+  ParallelSort(&vocab[1], vocab_size - 1, sizeof(struct vocab_word), VocabCompare, (num_threads > 1) ? num_threads : 1);
   size = vocab_size;
   train_words = 0;
   for (a = 0; a < size; a++) {
     // Words occuring less than min_count times will be discarded from the vocab
     if ((GetWordUsageI(a) < min_count) && (a != 0)) {
       vocab_size--;
-      if (!(vocab[a].count & SHORT_WORD)) free(vocab[a].w.word);
-    } else {
-      // Hash will be re-computed, as after the sorting it is not actual
-      hash=GetWordHash(GetWordPtrI(a));
-      while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-      vocab_hash[hash] = a;
-      train_words += GetWordUsageI(a);
-    }
+    } else train_words += GetWordUsageI(a);
   }
+  // Stores the remaining words in the new order; hashes will be re-computed, as after the sorting
+  // they are not actual
+  CompactStrings(&vocab_strings, vocab, vocab_size, sizeof(struct vocab_word), offsetof(struct vocab_word, word));
+  RebuildVocabHash();
+  vocab_words = train_words;
+  train_words -= init_words;  // Not in the training data
   vocab = (struct vocab_word *)realloc(vocab, (vocab_size + 1) * sizeof(struct vocab_word));
   // Allocate memory for the binary tree construction
   vocab_codes = (struct vocab_code *)calloc(vocab_size + 1, sizeof(struct vocab_code));
@@ -233,30 +372,24 @@ void SortVocab() {
 // Reduces the vocabulary by removing infrequent tokens
 void ReduceVocab() {
   int a, b = 0;
-  unsigned int hash;
   for (a = 0; a < vocab_size; a++) if (GetWordUsageI(a) > min_reduce) {
     memmove(&vocab[b], &vocab[a], sizeof(struct vocab_word));
     b++;
-  } else {
-     free(vocab[a].w.word);
   }
   vocab_size = b;
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  for (a = 0; a < vocab_size; a++) {
-    // Hash will be re-computed, as it is not actual
-    hash = GetWordHash(GetWordPtrI(a));
-    while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-    vocab_hash[hash] = a;
-  }
+  CompactStrings(&vocab_strings, vocab, vocab_size, sizeof(struct vocab_word), offsetof(struct vocab_word, word));
+  RebuildVocabHash();  // Hashes will be re-computed, as they are not actual
   fflush(stdout);
   min_reduce++;
 }
 
 // Create binary Huffman tree using the word counts
-// Frequent words will have short uniqe binary codes
+// Frequent words will have short uniqe binary codes. Inner nodes are created in order of rising
+// count, so numbering them backwards puts the root first and the nodes that most paths pass next to
+// it in syn1.
 void CreateBinaryTree() {
-  long long a, b, i, min1i, min2i, pos1, pos2, point[MAX_CODE_LENGTH];
-  char code[MAX_CODE_LENGTH];
+  long long a, b, i, min1i, min2i, pos1, pos2, point[MAX_CODE_LENGTH], points = 0;
+  unsigned long long code;
   long long *count = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
   long long *binary = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
   long long *parent_node = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
@@ -296,281 +429,926 @@ void CreateBinaryTree() {
     parent_node[min2i] = vocab_size + a;
     binary[min2i] = 1;
   }
-  // Now assign binary code to each vocabulary word
+  // Now assign binary code to each vocabulary word, after finding where its path goes
+  for (a = 0; a < vocab_size; a++) {
+    vocab_codes[a].points = points;
+    for (b = a; b != vocab_size * 2 - 2; b = parent_node[b]) points++;
+  }
+  vocab_codes[vocab_size].points = points;
+  free(code_points);
+  code_points = (int *)malloc(points * sizeof(int));
+  if (code_points == NULL) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
   for (a = 0; a < vocab_size; a++) {
     b = a;
     i = 0;
+    code = 0;
     while (1) {
-      code[i] = binary[b];
+      code = (code << 1) | binary[b];
       point[i] = b;
       i++;
       b = parent_node[b];
       if (b == vocab_size * 2 - 2) break;
     }
-    vocab_codes[a].codelen = i;
-    vocab_codes[a].point[0] = vocab_size - 2;
-    for (b = 0; b < i; b++) {
-      vocab_codes[a].code[i - b - 1] = code[b];
-      vocab_codes[a].point[i - b] = point[b] - vocab_size;
-    }
+    vocab_codes[a].code = code;  // The branch at the root came last, at bit 0
+    code_points[vocab_codes[a].points] = 0;  // The root
+    for (b = 1; b < i; b++) code_points[vocab_codes[a].points + i - b] = vocab_size * 2 - 2 - point[b];
   }
   free(count);
   free(binary);
   free(parent_node);
 }
 
-void LearnVocabFromTrainFile() {
+// Adds the words and counts written by WriteVocab() to the vocabulary; returns the sum of the counts
+long long ReadVocabCounts(FILE *fin) {
+  long long a, cn, sum = 0;
+  char c;
   char word[MAX_STRING];
-  FILE *fin;
-  long long a, i;
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  fin = fopen(train_file, "rb");
-  if (fin == NULL) {
-    printf("ERROR: training data file not found!\n");
-    exit(1);
-  }
-  vocab_size = 0;
-  AddWordToVocab((char *)"</s>");
   while (1) {
     ReadWord(word, fin);
     if (feof(fin)) break;
-    train_words++;
-    if ((debug_mode > 1) && (train_words % 100000 == 0)) {
-      printf("%lldK%c", train_words / 1000, 13);
+    fscanf(fin, "%lld%c", &cn, &c);
+    a = SearchVocab(word);
+    if (a == -1) {
+      a = AddWordToVocab(word);
+      vocab[a].count = cn;
+    } else vocab[a].count += cn;
+    sum += cn;
+  }
+  return sum;
+}
+
+long long AddVocabCounts(const char *file) {
+  long long sum;
+  FILE *fin = fopen(file, "rb");
+  if (fin == NULL) {
+    printf("Vocabulary file not found\n");
+    exit(1);
+  }
+  sum = ReadVocabCounts(fin);
+  fclose(fin);
+  return sum;
+}
+
+// One thread's part of the vocabulary pass: the words of [begin, end) of the training text and their
+// counts, in a private table. Words point into the mapped text.
+struct shard_word {
+  const char *word;
+  int len;
+  unsigned long long hash;
+  long long count;
+};
+
+struct vocab_shard {
+  long long begin, end, words;  // words: tokens read
+  struct shard_word *entries;
+  long long size, max_size;
+  struct word_hash hash;
+};
+
+long long vocab_progress = 0;  // Tokens read by all shards, for the progress display
+int vocab_overflow = 0;        // A shard has more distinct words than the vocabulary can hold
+
+static int SameShardWord(const void *ctx, int index, const char *word, int len) {
+  const struct shard_word *e = &((const struct vocab_shard *)ctx)->entries[index];
+  return (e->len == len) && !memcmp(e->word, word, len);
+}
+
+static inline void CountShardToken(struct vocab_shard *s, const struct token *tok) {
+  struct shard_word *e;
+  int i = WordHashFind(&s->hash, tok->hash, tok->word, tok->len, SameShardWord, s);
+  if (i != -1) {
+    s->entries[i].count++;
+    return;
+  }
+  if (s->size == s->max_size) {
+    s->max_size *= 2;
+    s->entries = (struct shard_word *)realloc(s->entries, s->max_size * sizeof(struct shard_word));
+  }
+  e = &s->entries[s->size];
+  e->word = tok->word;
+  e->len = tok->len;
+  e->hash = tok->hash;
+  e->count = 1;
+  WordHashInsert(&s->hash, tok->hash, s->size++);
+}
+
+void *CountShardThread(void *arg) {
+  struct vocab_shard *s = (struct vocab_shard *)arg;
+  struct token_reader tr;
+  struct token tok;
+  long long last = 0, total;
+  s->max_size = 1024;
+  s->entries = (struct shard_word *)malloc(s->max_size * sizeof(struct shard_word));
+  InitWordHash(&s->hash, s->max_size, NULL, NULL);
+  InitTokenReader(&tr, train_data, s->end, s->begin, MAX_STRING - 1);
+  while (ReadToken(&tr, &tok)) {
+    s->words++;
+    CountShardToken(s, &tok);
+    if (s->words - last < 100000) continue;
+    total = __atomic_add_fetch(&vocab_progress, s->words - last, __ATOMIC_RELAXED);
+    last = s->words;
+    if ((debug_mode > 1) && (s->begin == 0)) {
+      printf("%lldK%c", total / 1000, 13);
       fflush(stdout);
     }
-    i = SearchVocab(word);
+    if (s->size > vocab_limit) __atomic_store_n(&vocab_overflow, 1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&vocab_overflow, __ATOMIC_RELAXED)) break;
+  }
+  return NULL;
+}
+
+// Counts the words of the training text with one thread per shard of it, each ending after a
+// newline so that every shard tokenizes as it would in one pass, then adds the shards up in order.
+// Returns 0 if the vocabulary does not fit without ReduceVocab(), whose result depends on the order
+// the words come in; the single pass has to be used then.
+int LearnVocabSharded(int threads) {
+  struct vocab_shard *shards = (struct vocab_shard *)calloc(threads, sizeof(struct vocab_shard));
+  pthread_t *pt = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  struct shard_word *e;
+  struct token tok;
+  const char *nl;
+  char word[MAX_STRING];
+  long long a, i;
+  int t, ok = 1;
+  for (t = 0; t < threads; t++) {
+    shards[t].begin = (t == 0) ? 0 : shards[t - 1].end;
+    a = file_size / threads * (t + 1);
+    if (a < shards[t].begin) a = shards[t].begin;
+    nl = (const char *)memchr(train_data + a, '\n', file_size - a);
+    shards[t].end = ((t == threads - 1) || (nl == NULL)) ? file_size : nl - train_data + 1;
+  }
+  for (t = 1; t < threads; t++) pthread_create(&pt[t], NULL, CountShardThread, &shards[t]);
+  CountShardThread(&shards[0]);
+  for (t = 1; t < threads; t++) pthread_join(pt[t], NULL);
+  ok = !vocab_overflow;
+  for (t = 0; (t < threads) && ok; t++) {
+    for (a = 0; a < shards[t].size; a++) {
+      e = &shards[t].entries[a];
+      tok.word = e->word;
+      tok.len = e->len;
+      tok.hash = e->hash;
+      i = SearchToken(&tok);
+      if (i == -1) {
+        memcpy(word, e->word, e->len);
+        word[e->len] = 0;
+        i = AddWordToVocab(word);
+        vocab[i].count = e->count;
+      } else vocab[i].count += e->count;
+      if (vocab_size > vocab_limit) {
+        ok = 0;
+        break;
+      }
+    }
+    train_words += shards[t].words;
+  }
+  for (t = 0; t < threads; t++) {
+    free(shards[t].entries);
+    FreeWordHash(&shards[t].hash);
+  }
+  free(shards);
+  free(pt);
+  return ok;
+}
+
+// -vocab-memory: counts the words in one pass with a Space-Saving summary of vocab_memory bytes,
+// which keeps the frequent words with counts that are never too high, instead of pruning with
+// ReduceVocab() whenever the vocabulary fills up
+void LearnVocabTopK() {
+  struct topk_summary s;
+  struct topk_counter *c;
+  struct token_reader tr;
+  struct token tok;
+  char word[MAX_STRING];
+  long long a, i, capacity = TopKCapacity(vocab_memory);
+  if (capacity > vocab_limit) capacity = vocab_limit;
+  if (capacity < 2) {
+    printf("ERROR: -vocab-memory is too small\n");
+    exit(1);
+  }
+  InitTopK(&s, capacity);
+  InitTokenReader(&tr, train_data, file_size, 0, MAX_STRING - 1);
+  while (ReadToken(&tr, &tok)) {
+    TopKAdd(&s, tok.word, tok.len, tok.hash);
+    if ((debug_mode > 1) && (s.words % 100000 == 0)) {
+      printf("%lldK%c", s.words / 1000, 13);
+      fflush(stdout);
+    }
+  }
+  train_words = s.words;
+  for (a = 0; a < s.size; a++) {
+    c = &s.counters[a];
+    if (c->count - c->error == 0) continue;
+    tok.word = c->word;
+    tok.len = c->len;
+    tok.hash = c->hash;
+    i = SearchToken(&tok);  // Only </s> is there already
     if (i == -1) {
-      a = AddWordToVocab(word);
-    } else vocab[i].count++;
-    if (vocab_size > vocab_hash_size * 0.7) ReduceVocab();
+      memcpy(word, c->word, c->len);
+      word[c->len] = 0;
+      i = AddWordToVocab(word);
+      vocab[i].count = c->count - c->error;
+    } else vocab[i].count += c->count - c->error;
+  }
+  if (debug_mode > 0) {
+    printf("Vocabulary counted in %lld MB: %lld counters, counts up to %lld too low\n", TopKBytes(capacity) >> 20,
+           capacity, TopKMaxError(&s));
+  }
+  FreeTopK(&s);
+}
+
+void LearnVocabFromTrainFile() {
+  char word[MAX_STRING];
+  struct token_reader tr;
+  struct token tok;
+  long long i;
+  int threads = (num_threads > 1) ? num_threads : 1;
+  ClearVocab();
+  MapTrainFile();
+  AddWordToVocab((char *)"</s>");
+  if (threads > file_size / (1 << 20)) threads = file_size / (1 << 20) + 1;  // 1 MB or more per shard
+  if (vocab_memory > 0) {
+    LearnVocabTopK();
+    threads = 0;
+  } else if ((threads > 1) && !LearnVocabSharded(threads)) {
+    if (debug_mode > 0) printf("Vocabulary too large to count in shards, counting in one pass\n");
+    ClearVocab();
+    train_words = 0;
+    AddWordToVocab((char *)"</s>");
+    threads = 1;
   }
+  if (threads == 1) {
+    InitTokenReader(&tr, train_data, file_size, 0, MAX_STRING - 1);
+    while (ReadToken(&tr, &tok)) {
+      train_words++;
+      if ((debug_mode > 1) && (train_words % 100000 == 0)) {
+        printf("%lldK%c", train_words / 1000, 13);
+        fflush(stdout);
+      }
+      i = SearchToken(&tok);
+      if (i == -1) {
+        memcpy(word, tok.word, tok.len);
+        word[tok.len] = 0;
+        AddWordToVocab(word);
+      } else vocab[i].count++;
+      if (vocab_size > vocab_limit) ReduceVocab();
+    }
+  }
+  if (init_vocab_file[0] != 0) init_words = AddVocabCounts(init_vocab_file);
   SortVocab();
   if (debug_mode > 0) {
     printf("Vocab size: %lld\n", vocab_size);
     printf("Words in train file: %lld\n", train_words);
   }
-  file_size = ftell(fin);
-  fclose(fin);
 }
 
-void SaveVocab() {
+void WriteVocab(FILE *fo) {
   long long i;
-  FILE *fo = fopen(save_vocab_file, "wb");
   for (i = 0; i < vocab_size; i++) fprintf(fo, "%s %lld\n", GetWordPtrI(i), GetWordUsageI(i));
+}
+
+void SaveVocab(const char *file) {
+  FILE *fo = fopen(file, "wb");
+  if (fo == NULL) {
+    printf("ERROR: cannot write %s\n", file);
+    exit(1);
+  }
+  WriteVocab(fo);
   fclose(fo);
 }
 
-inline real DoMAC(const int n, real * __restrict__ a, real * __restrict__  b) 
-{ 
-	real output = 0;
-	int i = 0;
-
-	if ((!((unsigned long)a & 0x3f)) && (!((unsigned long)b & 0x3f))) {
-		real *aa = __builtin_assume_aligned(a, 64), *ba = __builtin_assume_aligned(b, 64);
-		for (i = 0; i < n; i++) output += aa[i] * ba[i];
-	} else if ((!((unsigned long)a & 0x1f)) && (!((unsigned long)b & 0x1f))) {
-		real *aa = __builtin_assume_aligned(a, 32), *ba = __builtin_assume_aligned(b, 32);
-		for (i = 0; i < n; i++) output += aa[i] * ba[i];
-	} else if ((!((unsigned long)a & 0x0f)) && (!((unsigned long)b & 0x0f))) {
-		real *aa = __builtin_assume_aligned(a, 16), *ba = __builtin_assume_aligned(b, 16);
-		for (i = 0; i < n; i++) output += aa[i] * ba[i];
-	} else {
-		for (i = 0; i < n; i++) {
-			output += a[i] * b[i]; 
-		}
-	}
-	return output;
+void ReadVocab() {
+  ClearVocab();
+  AddVocabCounts(read_vocab_file);
+  if (init_vocab_file[0] != 0) init_words = AddVocabCounts(init_vocab_file);
+  SortVocab();
+  if (debug_mode > 0) {
+    printf("Vocab size: %lld\n", vocab_size);
+    printf("Words in train file: %lld\n", train_words);
+  }
+  if (train_encoded_file[0] == 0) MapTrainFile();
 }
 
-inline void DoAdd(const int n, real * __restrict__ a, real * __restrict__  b) 
-{ 
-	int i = 0;
-
-	if ((!((unsigned long)a & 0x3f)) && (!((unsigned long)b & 0x3f))) {
-		real *aa = __builtin_assume_aligned(a, 64), *ba = __builtin_assume_aligned(b, 64);
-		for (i = 0; i < n; i++) aa[i] += ba[i];
-	} else if ((!((unsigned long)a & 0x1f)) && (!((unsigned long)b & 0x1f))) {
-		real *aa = __builtin_assume_aligned(a, 32), *ba = __builtin_assume_aligned(b, 32);
-		for (i = 0; i < n; i++) aa[i] += ba[i];
-	} else if ((!((unsigned long)a & 0x0f)) && (!((unsigned long)b & 0x0f))) {
-		real *aa = __builtin_assume_aligned(a, 16), *ba = __builtin_assume_aligned(b, 16);
-		for (i = 0; i < n; i++) aa[i] += ba[i];
-	} else {
-		for (i = 0; i < n; i++) a[i] += b[i];
-	}
+unsigned long long GetVocabChecksum() {
+  long long a;
+  unsigned long long checksum = CHECKSUM_INIT;
+  for (a = 0; a < vocab_size; a++) checksum = VocabChecksum(checksum, GetWordPtrI(a), GetWordUsageI(a));
+  return checksum;
 }
 
-void DoMAC1(const int n, real * __restrict__  out, real c, real * __restrict__  b) 
-{ 
-	int i = 0;
-
-	// On Sandy Bridge w/hyperthreading, alignment > 16 may or may not cause pipeline stalls, slowing down perf.
-	// Seems to be an icache issue
-/*	if ((!((unsigned long)out & 0x3f)) && (!((unsigned long)b & 0x3f))) {
-		real *outa = __builtin_assume_aligned(out, 64), *ba = __builtin_assume_aligned(b, 64);
-		for (i = 0; i < n; i++) outa[i] += c * ba[i];
-	} else */ if ((!((unsigned long)out & 0x1f)) && (!((unsigned long)b & 0x1f))) {
-		real *outa = __builtin_assume_aligned(out, 32), *ba = __builtin_assume_aligned(b, 32);
-		for (i = 0; i < n; i++) outa[i] += c * ba[i];
-	} else if ((!((unsigned long)out & 0x0f)) && (!((unsigned long)b & 0x0f))) {
-		real *outa = __builtin_assume_aligned(out, 16), *ba = __builtin_assume_aligned(b, 16);
-		for (i = 0; i < n; i++) outa[i] += c * ba[i];
-	} else {
-		for (i = 0; i < n; i++) out[i] += c * b[i];
-	}
+// Maps the token stream written by w2v-encode; it must have been encoded against this vocabulary
+void LoadEncodedCorpus() {
+  struct encoded_header header;
+  struct stat st;
+  int fd = open(train_encoded_file, O_RDONLY);
+  if ((fd < 0) || (fstat(fd, &st) != 0)) {
+    printf("ERROR: encoded training data file not found!\n");
+    exit(1);
+  }
+  if ((st.st_size < sizeof(header)) || (read(fd, &header, sizeof(header)) != sizeof(header)) ||
+      memcmp(header.magic, ENCODED_MAGIC, sizeof(header.magic))) {
+    printf("ERROR: %s is not an encoded training file\n", train_encoded_file);
+    exit(1);
+  }
+  if ((header.vocab_size != vocab_size) || (header.vocab_checksum != GetVocabChecksum())) {
+    printf("ERROR: %s was encoded with a different vocabulary (or -min-count)\n", train_encoded_file);
+    exit(1);
+  }
+  file_size = st.st_size - sizeof(header);
+  encoded_data = (unsigned char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (encoded_data == MAP_FAILED) {
+    printf("ERROR: cannot map %s\n", train_encoded_file);
+    exit(1);
+  }
+  madvise(encoded_data, st.st_size, MADV_SEQUENTIAL);
+  encoded_data += sizeof(header);
+  close(fd);
+  // Checked once here, so that the readers can decode without bounds checks
+  if (CountEncoded(encoded_data, file_size, vocab_size) != header.token_count) {
+    printf("ERROR: %s is corrupt\n", train_encoded_file);
+    exit(1);
+  }
+  if (debug_mode > 0) printf("Encoded tokens: %lld\n", header.token_count);
 }
 
-void ReadVocab() {
-  long long a, i = 0;
-  long long cn;
-  char c;
+// Allocates a weight matrix in huge pages as set by -huge-pages; with -numa its pages are
+// interleaved over the nodes before first use
+void *AllocMatrix(long long bytes, const char *name) {
+  void *p = AllocHuge(bytes, huge_pages, name, debug_mode > 1);
+  if (numa && (InterleaveMemory(&topology, p, bytes) != 0) && (debug_mode > 0)) {
+    printf("WARNING: cannot interleave the weights over the NUMA nodes\n");
+  }
+  return p;
+}
+
+// Points the weight matrices into the segment of a shared run, which comes zeroed
+void MapSharedWeights() {
+  char *base = (char *)shared;
+  long long bytes = shared->bytes - shared->syn0_offset;
+  if (storage != STORAGE_FP32) syn0_half = (unsigned short *)(base + shared->syn0_offset);
+  else syn0 = (real *)(base + shared->syn0_offset);
+  if (hs) syn1 = (real *)(base + shared->syn1_offset);
+  if ((negative > 0) && (storage != STORAGE_FP32)) syn1neg_half = (unsigned short *)(base + shared->syn1neg_offset);
+  else if (negative > 0) syn1neg = (real *)(base + shared->syn1neg_offset);
+  // Shared memory gets transparent huge pages where /sys/kernel/mm/transparent_hugepage/shmem_enabled allows
+  if (huge_pages != HUGE_OFF) madvise(base + shared->syn0_offset, bytes, MADV_HUGEPAGE);
+  if (numa && (InterleaveMemory(&topology, base + shared->syn0_offset, bytes) != 0) && (debug_mode > 0)) {
+    printf("WARNING: cannot interleave the weights over the NUMA nodes\n");
+  }
+}
+
+// The matrices come from fresh anonymous mappings, which are zero (+0 in the half formats too), so
+// the output weights need no memset(): their pages are only touched by the training threads
+void AllocWeights() {
+  if (storage != STORAGE_FP32) syn0_half = (unsigned short *)AllocMatrix((long long)vocab_size * layer1_size * sizeof(unsigned short), "syn0");
+  else syn0 = (real *)AllocMatrix((long long)vocab_size * layer1_size * sizeof(real), "syn0");
+
+  if (hs) syn1 = (real *)AllocMatrix((long long)vocab_size * layer1_size * sizeof(real), "syn1");
+
+  if ((negative>0) && (storage != STORAGE_FP32)) {
+    syn1neg_half = (unsigned short *)AllocMatrix((long long)vocab_size * layer1_size * sizeof(unsigned short), "syn1neg");
+  } else if (negative>0) {
+    syn1neg = (real *)AllocMatrix((long long)vocab_size * layer1_size * sizeof(real), "syn1neg");
+  }
+}
+
+// State of the generator r = (r + 11) * 25214903917 steps steps after r, by repeated squaring of
+// the affine step
+static unsigned long long SkipRandom(unsigned long long r, unsigned long long steps) {
+  unsigned long long mul = 25214903917ULL, add = 11 * 25214903917ULL, skip_mul = 1, skip_add = 0;
+  while (steps > 0) {
+    if (steps & 1) {
+      skip_mul *= mul;
+      skip_add = skip_add * mul + add;
+    }
+    add = add * mul + add;
+    mul *= mul;
+    steps >>= 1;
+  }
+  return skip_mul * r + skip_add;
+}
+
+// Rows [begin, end) of syn0 for InitNet()
+struct init_task {
+  long long begin, end;
+};
+
+// Sets the rows of a task to the values one generator going through all of syn0 from 1 gives them,
+// starting from its state at the first row, so the result does not depend on how rows are split
+void *InitRowsThread(void *arg) {
+  struct init_task *t = (struct init_task *)arg;
+  unsigned long long next_random = SkipRandom(1, t->begin * layer1_size);
+  long long a, b;
+  real w;
+  for (a = t->begin; a < t->end; a++) for (b = 0; b < layer1_size; b++) {
+    next_random = (next_random + 11) * (unsigned long long)25214903917;
+    w = (((next_random & 0xFFFF) / (real)65536) - 0.5) / layer1_size;
+    if (storage == STORAGE_FP32) syn0[a * layer1_size + b] = w;
+    else StoreHalfRow(1, &syn0_half[a * layer1_size + b], &w, storage, NULL);
+  }
+  return NULL;
+}
+
+void InitNet() {
+  int a, threads = (num_threads > 1) ? num_threads : 1;
+  struct init_task *tasks;
+  pthread_t *pt;
+  if (shared != NULL) MapSharedWeights(); else AllocWeights();
+
+  // Every thread writes its own rows, which also spreads their first touch over the threads
+  if (threads > vocab_size) threads = vocab_size;
+  tasks = (struct init_task *)malloc(threads * sizeof(struct init_task));
+  pt = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  for (a = 0; a < threads; a++) {
+    tasks[a].begin = vocab_size * a / threads;
+    tasks[a].end = vocab_size * (a + 1) / threads;
+  }
+  for (a = 1; a < threads; a++) pthread_create(&pt[a], NULL, InitRowsThread, &tasks[a]);
+  InitRowsThread(&tasks[0]);
+  for (a = 1; a < threads; a++) pthread_join(pt[a], NULL);
+  free(tasks);
+  free(pt);
+
+  if (!vocab_tables) CreateBinaryTree();
+}
+
+// Vectors written in binary have one float after another up to the newline; text ones only have
+// the characters of numbers and spaces. Looks at the row that starts at the current position.
+int IsBinaryRow(FILE *fin, long long size) {
+  long long pos = ftell(fin), a, n = size * sizeof(real) + 1;
+  unsigned char *row = (unsigned char *)malloc(n);
+  int is_binary = 0;
+  if ((row != NULL) && (fread(row, 1, n, fin) == n) && (row[n - 1] == '\n')) {
+    for (a = 0; a < n - 1; a++) if (!strchr("0123456789.-+eE ", row[a]) || (row[a] == 0)) is_binary = 1;
+  }
+  free(row);
+  fseek(fin, pos, SEEK_SET);
+  return is_binary;
+}
+
+// Reads vectors written by an earlier run (text or binary, like -output writes them) into the rows
+// of the matrix syn, or syn_half with half storage, for the words that are in the vocabulary.
+// Sets loaded[] of those rows if it is not NULL and returns how many there were.
+long long LoadVectors(const char *file, real *syn, unsigned short *syn_half, unsigned char *loaded) {
+  long long words, size, a, b, i, count = 0;
   char word[MAX_STRING];
-  FILE *fin = fopen(read_vocab_file, "rb");
+  int is_binary = 0;
+  real *row = (real *)malloc(layer1_size * sizeof(real));
+  FILE *fin = fopen(file, "rb");
   if (fin == NULL) {
-    printf("Vocabulary file not found\n");
+    printf("ERROR: %s not found\n", file);
     exit(1);
   }
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  vocab_size = 0;
-  while (1) {
-    ReadWord(word, fin);
-    if (feof(fin)) break;
-    a = AddWordToVocab(word);
-
-    fscanf(fin, "%lld%c", &cn, &c);
-    vocab[a].count = (vocab[a].count & SHORT_WORD) | cn;
-    i++;
+  if ((fscanf(fin, "%lld %lld", &words, &size) != 2) || (size != layer1_size)) {
+    printf("ERROR: %s does not hold vectors of -size %lld\n", file, (long long)layer1_size);
+    exit(1);
   }
-  SortVocab();
-  if (debug_mode > 0) {
-    printf("Vocab size: %lld\n", vocab_size);
-    printf("Words in train file: %lld\n", train_words);
+  for (a = 0; a < words; a++) {
+    if (fscanf(fin, "%99s", word) != 1) break;
+    fgetc(fin);  // The space after the word
+    if (a == 0) is_binary = IsBinaryRow(fin, size);
+    if (is_binary) {
+      if (fread(row, sizeof(real), size, fin) != size) break;
+    } else {
+      for (b = 0; b < size; b++) if (fscanf(fin, "%f", &row[b]) != 1) break;
+      if (b < size) break;
+    }
+    i = SearchVocab(word);
+    if (i == -1) continue;
+    if (syn_half != NULL) StoreHalfRow(layer1_size, &syn_half[i * layer1_size], row, storage, NULL);
+    else memcpy(&syn[i * layer1_size], row, layer1_size * sizeof(real));
+    if (loaded != NULL) loaded[i] = 1;
+    count++;
   }
-  fin = fopen(train_file, "rb");
-  if (fin == NULL) {
-    printf("ERROR: training data file not found!\n");
+  if (a < words) {
+    printf("ERROR: %s is truncated\n", file);
     exit(1);
   }
-  fseek(fin, 0, SEEK_END);
-  file_size = ftell(fin);
   fclose(fin);
+  free(row);
+  if (debug_mode > 0) printf("Initialized %lld of %lld rows from %s\n", count, vocab_size, file);
+  return count;
 }
 
-void InitNet() {
+// Writes the rows of syn like -output does, text or binary as set by -binary
+void SaveVectors(const char *file, real *syn) {
   long long a, b;
-  unsigned long long next_random = 1;
-  a = posix_memalign((void **)&syn0, 128, (long long)vocab_size * layer1_size * sizeof(real));
-  if (syn0 == NULL) {printf("Memory allocation failed\n"); exit(1);}
+  FILE *fo = fopen(file, "wb");
+  if (fo == NULL) {
+    printf("ERROR: cannot write %s\n", file);
+    exit(1);
+  }
+  fprintf(fo, "%lld %lld\n", vocab_size, layer1_size);
+  for (a = 0; a < vocab_size; a++) {
+    fprintf(fo, "%s ", GetWordPtrI(a));
+    if (binary) for (b = 0; b < layer1_size; b++) fwrite(&syn[a * layer1_size + b], sizeof(real), 1, fo);
+    else for (b = 0; b < layer1_size; b++) fprintf(fo, "%lf ", syn[a * layer1_size + b]);
+    fprintf(fo, "\n");
+  }
+  fclose(fo);
+}
 
-  if (hs) {
-    a = posix_memalign((void **)&syn1, 128, (long long)vocab_size * layer1_size * sizeof(real));
-    if (syn1 == NULL) {printf("Memory allocation failed\n"); exit(1);}
-    memset(syn1, 0, (long long)vocab_size * layer1_size * sizeof(real));
+// Seed for the random numbers of thread id, different in every process of a shared run
+static inline unsigned long long ThreadSeed(long long id) {
+  return id + ((unsigned long long)worker_id << 10);
+}
+
+// Per-thread scratch space for the training updates
+struct thread_buffers {
+  real *neu1, *neu1e;
+  // -batch-neg: gathered context rows, output rows, their gradients and the score matrix
+  real *ctx, *dctx, *out, *dout, *grad, *gradt;
+  long long *targets;  // Output rows of the current position, for -batch-neg and UpdateOutputRows()
+  real *scores;        // Their scores, then gradients
+  real *labels;        // Their labels: hierarchical softmax code bits
+  real *neg_labels;    // 1 for the word, 0 for every negative
+  // Negative samples: a ring of prefetch + 1 sets drawn ahead from their own generator, so that
+  // their output rows can be prefetched; see NextNegatives()
+  long long *negs, neg_calls;
+  unsigned long long neg_random;
+  // -storage bf16/fp16: fp32 copy of an input row (output rows go to out), stochastic rounding counter
+  real *in;
+  unsigned long long round_random;
+  int node;        // -numa node the thread is pinned to
+  long long rows;  // Weight rows read or written, each read-modify-write counting as 2
+  // -hot-rows: the replicas of the hot output rows, their values at the last merge, and counts
+  real *hot, *hot_base;
+  long long hot_words, output_updates, hot_updates, hot_merged;
+};
+
+// -hot-rows: adds what the thread changed in its replicas since the last merge to the shared rows,
+// and reloads the replicas from there, with the changes of the other threads. Rows the thread did
+// not change are only read.
+void MergeHotRows(struct thread_buffers *tb) {
+  long long c, l, changed;
+  real *hot = tb->hot, *base = tb->hot_base;
+  for (l = 0; l < hot_rows * layer1_size; l += layer1_size) {
+    changed = 0;
+    for (c = l; c < l + layer1_size; c++) {
+      base[c] = hot[c] - base[c];
+      changed |= (base[c] != 0);
+    }
+    if (storage == STORAGE_FP32) {
+      if (changed) DoAdd(layer1_size, &syn1neg[l], &base[l]);
+      memcpy(&hot[l], &syn1neg[l], layer1_size * sizeof(real));
+    } else {
+      if (changed) AddToHalfRow(layer1_size, &syn1neg_half[l], &base[l], storage, stochastic_round ? &tb->round_random : NULL);
+      LoadHalfRow(layer1_size, &hot[l], &syn1neg_half[l], storage);
+    }
+    memcpy(&base[l], &hot[l], layer1_size * sizeof(real));
+    tb->hot_merged += changed;
   }
+  tb->hot_words = 0;
+}
 
-  if (negative>0) {
-    a = posix_memalign((void **)&syn1neg, 128, (long long)vocab_size * layer1_size * sizeof(real));
-    if (syn1neg == NULL) {printf("Memory allocation failed\n"); exit(1);}
-    memset(syn1neg, 0, (long long)vocab_size * layer1_size * sizeof(real));
+// Merges once the thread has trained on hot_sync words since the last merge
+static inline void HotRowsTrained(struct thread_buffers *tb, long long words) {
+  tb->hot_words += words;
+  if (tb->hot_words >= hot_sync) MergeHotRows(tb);
+}
+
+real *AllocRows(long long rows) {
+  real *p;
+  if (posix_memalign((void **)&p, 128, rows * layer1_size * sizeof(real))) {
+    printf("Memory allocation failed\n");
+    exit(1);
   }
+  return p;
+}
 
-  for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++) {
-    next_random = (next_random + 11) * (unsigned long long)25214903917;
-    syn0[a * layer1_size + b] = (((next_random & 0xFFFF) / (real)65536) - 0.5) / layer1_size;
+// Called by trainer thread id itself. Under -numa the thread is pinned first, so that the buffers
+// are allocated and touched on its own node.
+void AllocThreadBuffers(struct thread_buffers *tb, long long id) {
+  long long outputs;
+  memset(tb, 0, sizeof(*tb));
+  if (numa) {
+    tb->node = PinThread(&topology, id);
+    __atomic_add_fetch(&node_threads[tb->node], 1, __ATOMIC_RELAXED);
+  }
+  tb->neu1 = AllocRows(1);
+  tb->neu1e = AllocRows(1);
+  if (storage != STORAGE_FP32) {
+    tb->in = AllocRows(1);
+    tb->round_random = ThreadSeed(id) << 48;  // Threads draw from disjoint ranges of the counter
+  }
+  outputs = (negative + 1 > MAX_CODE_LENGTH) ? negative + 1 : MAX_CODE_LENGTH;
+  tb->targets = (long long *)malloc(outputs * sizeof(long long));
+  tb->scores = (real *)malloc(outputs * sizeof(real));
+  tb->labels = (real *)malloc(outputs * sizeof(real));
+  tb->neg_labels = (real *)calloc(outputs, sizeof(real));
+  tb->neg_labels[0] = 1;
+  if (negative > 0) {
+    tb->negs = (long long *)malloc((prefetch + 1) * negative * sizeof(long long));
+    tb->neg_random = ~ThreadSeed(id);
+  }
+  if ((negative > 0) && (batch_neg || (storage != STORAGE_FP32))) tb->out = AllocRows(negative + 1);
+  if (batch_neg) {
+    tb->ctx = AllocRows(window * 2);
+    tb->dctx = AllocRows(window * 2);
+    tb->dout = AllocRows(negative + 1);
+    tb->grad = (real *)malloc(window * 2 * (negative + 1) * sizeof(real));
+    tb->gradt = (real *)malloc(window * 2 * (negative + 1) * sizeof(real));
+  }
+  if (hot_rows > 0) {
+    tb->hot = AllocRows(hot_rows);
+    tb->hot_base = AllocRows(hot_rows);
+    memset(tb->hot, 0, hot_rows * layer1_size * sizeof(real));
+    memset(tb->hot_base, 0, hot_rows * layer1_size * sizeof(real));
+    MergeHotRows(tb);  // Nothing to add yet, only loads them
   }
+}
 
-  CreateBinaryTree();
+void FreeThreadBuffers(struct thread_buffers *tb) {
+  free(tb->neu1);
+  free(tb->neu1e);
+  free(tb->ctx);
+  free(tb->dctx);
+  free(tb->out);
+  free(tb->dout);
+  free(tb->grad);
+  free(tb->gradt);
+  free(tb->targets);
+  free(tb->scores);
+  free(tb->labels);
+  free(tb->neg_labels);
+  free(tb->negs);
+  free(tb->in);
+  free(tb->hot);
+  free(tb->hot_base);
+  __atomic_add_fetch(&node_rows[tb->node], tb->rows, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&output_updates, tb->output_updates, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&hot_updates, tb->hot_updates, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&hot_merged, tb->hot_merged, __ATOMIC_RELAXED);
 }
 
-const real EXP_SCALE = (real)EXP_TABLE_SIZE / (real)MAX_EXP;
+// Row access that works with either storage. Rows are addressed by their first element, l.
+// With half storage LoadInputRow() converts the row into copy and returns that; the change to an
+// output row converted by UpdateOutputRows() is added back with AddToHalfOutputRow().
+static inline real *LoadInputRow(long long l, real *copy, const long long n) {
+  if (storage == STORAGE_FP32) return &syn0[l];
+  LoadHalfRow(n, copy, &syn0_half[l], storage);
+  return copy;
+}
 
-inline real getExp(real r)
-{
-	real rabs = fabs(r), rv = 0.5;
+static inline void AddToHalfOutputRow(long long l, const real *delta, const long long n, struct thread_buffers *tb) {
+  AddToHalfRow(n, &syn1neg_half[l], delta, storage, stochastic_round ? &tb->round_random : NULL);
+}
 
-	if (rabs < MAX_EXP) {
-		rv = expTable[(int)(rabs * EXP_SCALE)];
-	}
+static inline void AddToInputRow(long long l, const real *delta, const long long n, struct thread_buffers *tb) {
+  if ((frozen != NULL) && frozen[l / n]) return;
+  if (storage == STORAGE_FP32) DoAdd(n, &syn0[l], delta);
+  else AddToHalfRow(n, &syn0_half[l], delta, storage, stochastic_round ? &tb->round_random : NULL);
+}
 
-	rv = (r > 0) ? (0.5 + rv) : (0.5 - rv);
+static inline void AddToOutputRow(long long l, const real *delta, const long long n, struct thread_buffers *tb) {
+  tb->output_updates++;
+  if (l < hot_rows * n) {
+    DoAdd(n, &tb->hot[l], delta);
+    tb->hot_updates++;
+  } else if (storage == STORAGE_FP32) DoAdd(n, &syn1neg[l], delta);
+  else AddToHalfRow(n, &syn1neg_half[l], delta, storage, stochastic_round ? &tb->round_random : NULL);
+}
 
-	return rv;
+// After training with half storage: replaces syn0_half by a fp32 syn0, and syn1neg_half by a
+// fp32 syn1neg for -save-context or frees it, so the vectors are written out exactly as with
+// fp32 training
+void ExpandHalfStorage() {
+  long long a;
+  if ((syn1neg_half != NULL) && (save_context_file[0] != 0)) {
+    syn1neg = (real *)AllocMatrix((long long)vocab_size * layer1_size * sizeof(real), "syn1neg");
+    for (a = 0; a < vocab_size; a++) LoadHalfRow(layer1_size, &syn1neg[a * layer1_size], &syn1neg_half[a * layer1_size], storage);
+  }
+  FreeHuge(syn1neg_half);
+  syn1neg_half = NULL;
+  syn0 = (real *)AllocMatrix((long long)vocab_size * layer1_size * sizeof(real), "syn0");
+  for (a = 0; a < vocab_size; a++) LoadHalfRow(layer1_size, &syn0[a * layer1_size], &syn0_half[a * layer1_size], storage);
+  FreeHuge(syn0_half);
+  syn0_half = NULL;
 }
 
-void *TrainModelThread(void *id) {
-  long long a, b, d, cw, word, last_word, sentence_length = 0, sentence_position = 0;
-  long long word_count = 0, last_word_count = 0, sen[MAX_SENTENCE_LENGTH + 1];
-  long long l1, l2, c, target, label, local_iter = iter;
-  unsigned long long next_random = (long long)id;
-  real f, g;
-  clock_t now;
+// out[i * n + j] = a_i . b_j, for the m rows of a and the n rows of b. Rows are taken two by two so
+// every load feeds two dot products.
+void MatMulABt(real *out, real *a, long long m, real *b, long long n) {
+  long long i, j, c;
+  for (i = 0; i + 1 < m; i += 2) {
+    real *a0 = &a[i * layer1_size], *a1 = a0 + layer1_size;
+    for (j = 0; j + 1 < n; j += 2) {
+      real *b0 = &b[j * layer1_size], *b1 = b0 + layer1_size;
+      real s00 = 0, s01 = 0, s10 = 0, s11 = 0;
+      for (c = 0; c < layer1_size; c++) {
+        s00 += a0[c] * b0[c];
+        s01 += a0[c] * b1[c];
+        s10 += a1[c] * b0[c];
+        s11 += a1[c] * b1[c];
+      }
+      out[i * n + j] = s00;
+      out[i * n + j + 1] = s01;
+      out[(i + 1) * n + j] = s10;
+      out[(i + 1) * n + j + 1] = s11;
+    }
+    if (j < n) {
+      out[i * n + j] = DoMAC(layer1_size, a0, &b[j * layer1_size]);
+      out[(i + 1) * n + j] = DoMAC(layer1_size, a1, &b[j * layer1_size]);
+    }
+  }
+  if (i < m) for (j = 0; j < n; j++) out[i * n + j] = DoMAC(layer1_size, &a[i * layer1_size], &b[j * layer1_size]);
+}
 
-  real *neu1;
-  a = posix_memalign((void **)&neu1, 128, layer1_size * sizeof(real));
-  real *neu1e; // = (real *)calloc(layer1_size, sizeof(real));
-  a = posix_memalign((void **)&neu1e, 128, layer1_size * sizeof(real));
+// c = g * b, where c is m rows, g is m x n and b is n rows
+void MatMul(real *c, real *g, long long m, real *b, long long n) {
+  long long i, j, x;
+  for (i = 0; i < m; i++) {
+    real *ci = &c[i * layer1_size];
+    for (x = 0; x < layer1_size; x++) ci[x] = 0;
+    for (j = 0; j < n; j++) DoMAC1(layer1_size, ci, g[i * n + j], &b[j * layer1_size]);
+  }
+}
+// Software prefetch of the rows a coming step will use. A random row of a matrix larger than the
+// last level cache is a DRAM miss, and the training step has nothing else to do while it waits.
+static inline void PrefetchRow(const void *p, long long bytes) {
+  long long c;
+  for (c = 0; c < bytes; c += 64) __builtin_prefetch((const char *)p + c, 1, 3);
+}
 
-  FILE *fi = fopen(train_file, "rb");
+static inline void PrefetchInputRow(long long word, const long long layer1_size) {
+  if (storage == STORAGE_FP32) PrefetchRow(&syn0[word * layer1_size], layer1_size * sizeof(real));
+  else PrefetchRow(&syn0_half[word * layer1_size], layer1_size * sizeof(unsigned short));
+}
 
-  memset(sen, 0, sizeof(sen));
+static inline void PrefetchOutputRow(long long word, const long long layer1_size) {
+  if (word < hot_rows) return;  // In the replica
+  if (storage == STORAGE_FP32) PrefetchRow(&syn1neg[word * layer1_size], layer1_size * sizeof(real));
+  else PrefetchRow(&syn1neg_half[word * layer1_size], layer1_size * sizeof(unsigned short));
+}
 
-  fseek(fi, file_size / (long long)num_threads * (long long)id, SEEK_SET);
-  while (1) {
-    if (word_count - last_word_count > 10000) {
-      word_count_actual += word_count - last_word_count;
-      last_word_count = word_count;
-      if ((debug_mode > 1)) {
-        now=clock();
-        printf("%cAlpha: %f  Progress: %.2f%%  Words/thread/sec: %.2fk  ", 13, alpha,
-         word_count_actual / (real)(iter * train_words + 1) * 100,
-         word_count_actual / ((real)(now - start + 1) / (real)CLOCKS_PER_SEC * 1000));
-        fflush(stdout);
-      }
-      alpha = starting_alpha * (1 - word_count_actual / (real)(iter * train_words + 1));
-      if (alpha < starting_alpha * 0.0001) alpha = starting_alpha * 0.0001;
-    }
-    if (sentence_length == 0) {
-      while (1) {
-	real ran;
-        word = ReadWordIndex(fi);
-        if (feof(fi)) break;
-        if (word == -1) continue;
-        word_count++;
-        if (word == 0) break;
-        // The subsampling randomly discards frequent words while keeping the ranking same
-        if (sample > 0) {
-          next_random = (next_random + 11) * (unsigned long long)25214903917;
-          ran = (sqrt(GetWordUsageI(word) / (sample * train_words)) + 1) * (sample * train_words) / GetWordUsageI(word);
-          if (ran < (next_random & 0xFFFF) / (real)65536) continue;
-        }
-        sen[sentence_length] = word;
-        sentence_length++;
-        if (sentence_length >= MAX_SENTENCE_LENGTH) break;
-      }
-      sentence_position = 0;
+// Returns the negatives for this step. The set for prefetch steps later is drawn now, into the slot
+// the previous step used, and its rows are prefetched.
+static inline long long *NextNegatives(struct thread_buffers *tb, const long long layer1_size) {
+  long long d, *set;
+  if (tb->neg_calls == 0) for (d = 0; d < prefetch; d++) {
+    DrawNegatives(&tb->negs[d * negative], &tb->neg_random);
+    for (set = &tb->negs[d * negative]; set < &tb->negs[(d + 1) * negative]; set++) PrefetchOutputRow(*set, layer1_size);
+  }
+  set = &tb->negs[((tb->neg_calls + prefetch) % (prefetch + 1)) * negative];
+  DrawNegatives(set, &tb->neg_random);
+  if (prefetch) for (d = 0; d < negative; d++) PrefetchOutputRow(set[d], layer1_size);
+  return &tb->negs[(tb->neg_calls++ % (prefetch + 1)) * negative];
+}
+
+// Prefetches for the position prefetch steps after pos: the input row entering the window there,
+// its word's output row, and for hierarchical softmax the rows of the path to it. The path itself,
+// in code_points, is prefetched another step earlier, and its entry of vocab_codes one more.
+static inline void PrefetchPosition(long long *sen, long long sentence_length, long long pos, const long long layer1_size) {
+  long long p = pos + prefetch, d, word, len;
+  const int *point;
+  if ((p + window < sentence_length) && (sen[p + window] != -1)) PrefetchInputRow(sen[p + window], layer1_size);
+  if ((p >= sentence_length) || (sen[p] == -1)) return;
+  word = sen[p];
+  if (negative > 0) PrefetchOutputRow(word, layer1_size);
+  if (hs) {
+    point = &code_points[vocab_codes[word].points];
+    len = CodeLength(word);
+    for (d = 0; d < len; d++) PrefetchRow(&syn1[point[d] * layer1_size], layer1_size * sizeof(real));
+    p += prefetch;
+    if ((p < sentence_length) && (sen[p] != -1)) {
+      PrefetchRow(&code_points[vocab_codes[sen[p]].points], CodeLength(sen[p]) * sizeof(int));
     }
+    p += prefetch;
+    if ((p < sentence_length) && (sen[p] != -1)) PrefetchRow(&vocab_codes[sen[p]], 2 * sizeof(struct vocab_code));
+  }
+}
+
+// Skip-gram with one set of negatives per center word (-batch-neg). The context rows and the
+// output rows (the word plus its negatives) are gathered once, scored against each other as one
+// small matrix product, and the gradients of both sides are two more products, so each row is
+// read from the shared matrices once per center word instead of once per (context, target) pair.
+void TrainSkipGramBatch(long long *sen, long long sentence_length, long long sentence_position, long long b,
+                        struct thread_buffers *tb) {
+  long long a, c, d, i, j, k = 0, n = 1, target, word = sen[sentence_position];
+  long long ctx_words[MAX_SENTENCE_LENGTH], *negs;
+  real *grad = tb->grad, *gradt = tb->gradt;
+
+  for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
+    c = sentence_position - window + a;
+    if ((c < 0) || (c >= sentence_length)) continue;
+    if (sen[c] == -1) continue;
+    ctx_words[k] = sen[c];
+    if (storage == STORAGE_FP32) memcpy(&tb->ctx[k * layer1_size], &syn0[sen[c] * layer1_size], layer1_size * sizeof(real));
+    else LoadHalfRow(layer1_size, &tb->ctx[k * layer1_size], &syn0_half[sen[c] * layer1_size], storage);
+    k++;
+  }
+  if (k == 0) return;
+
+  tb->targets[0] = word;
+  negs = NextNegatives(tb, layer1_size);
+  for (d = 0; d < negative; d++) {
+    target = negs[d];
+    if (target == word) continue;
+    tb->targets[n++] = target;
+  }
+  for (j = 0; j < n; j++) {
+    if (tb->targets[j] < hot_rows) memcpy(&tb->out[j * layer1_size], &tb->hot[tb->targets[j] * layer1_size], layer1_size * sizeof(real));
+    else if (storage == STORAGE_FP32) memcpy(&tb->out[j * layer1_size], &syn1neg[tb->targets[j] * layer1_size], layer1_size * sizeof(real));
+    else LoadHalfRow(layer1_size, &tb->out[j * layer1_size], &syn1neg_half[tb->targets[j] * layer1_size], storage);
+  }
 
-    if (feof(fi) || (word_count > train_words / num_threads)) {
-      word_count_actual += word_count - last_word_count;
-      local_iter--;
-      if (local_iter == 0) break;
-      word_count = 0;
-      last_word_count = 0;
-      sentence_length = 0;
-      fseek(fi, file_size / (long long)num_threads * (long long)id, SEEK_SET);
-      continue;
+  // Scores, then gradients multiplied by the learning rate; the first column is the positive one
+  MatMulABt(grad, tb->ctx, k, tb->out, n);
+  for (i = 0; i < k; i++) {
+    DoSigmoidGrad(n, &grad[i * n], tb->neg_labels, alpha);
+    for (j = 0; j < n; j++) gradt[j * k + i] = grad[i * n + j];
+  }
+  MatMul(tb->dctx, grad, k, tb->out, n);
+  MatMul(tb->dout, gradt, n, tb->ctx, k);
+
+  for (j = 0; j < n; j++) AddToOutputRow(tb->targets[j] * layer1_size, &tb->dout[j * layer1_size], layer1_size, tb);
+  for (i = 0; i < k; i++) AddToInputRow(ctx_words[i] * layer1_size, &tb->dctx[i * layer1_size], layer1_size, tb);
+  tb->rows += 3 * (k + n);
+}
+
+// Trains the n output rows of targets against the hidden vector x with the given labels; err gets
+// the gradient for x. The rows come from syn1 for hierarchical softmax (hs set), syn1neg otherwise,
+// or for -hot-rows the thread's replica.
+// All the dot products are taken first and turned into gradients with one DoSigmoidGrad() call, then
+// every row is updated. The rows are distinct and x does not change, so this matches updating them
+// one by one, except that a negative drawn twice now sees its old values both times; both of its
+// updates still land. With half storage the rows are converted copies, so what goes back to
+// syn1neg_half is the change, not the copy, which would undo the first of two updates.
+static inline __attribute__((always_inline)) void UpdateOutputRows(const real *x, real *err, long long n,
+    const long long *targets, const real *labels, int hs, struct thread_buffers *tb, const long long layer1_size) {
+  long long j, c;
+  real *row;
+  for (j = 0; j < n; j++) {
+    if (hs) row = &syn1[targets[j] * layer1_size];
+    else if (targets[j] < hot_rows) row = &tb->hot[targets[j] * layer1_size];
+    else if (storage == STORAGE_FP32) row = &syn1neg[targets[j] * layer1_size];
+    else {
+      row = &tb->out[j * layer1_size];
+      LoadHalfRow(layer1_size, row, &syn1neg_half[targets[j] * layer1_size], storage);
     }
+    tb->scores[j] = DoMAC(layer1_size, x, row);
+  }
+  DoSigmoidGrad(n, tb->scores, labels, alpha);
+  for (j = 0; j < n; j++) {
+    if (hs) row = &syn1[targets[j] * layer1_size];
+    else if (targets[j] < hot_rows) row = &tb->hot[targets[j] * layer1_size];
+    else if (storage == STORAGE_FP32) row = &syn1neg[targets[j] * layer1_size];
+    else row = &tb->out[j * layer1_size];
+    DoUpdate(layer1_size, x, row, err, tb->scores[j]);
+    if (hs) continue;
+    tb->output_updates++;
+    if (targets[j] < hot_rows) tb->hot_updates++;
+    else if (storage != STORAGE_FP32) {
+      for (c = 0; c < layer1_size; c++) row[c] = tb->scores[j] * x[c];  // The copy becomes the change
+      AddToHalfOutputRow(targets[j] * layer1_size, row, layer1_size, tb);
+    }
+  }
+}
 
+// Hierarchical softmax: the inner nodes on the path to word, labelled with the code bits
+static inline __attribute__((always_inline)) void TrainCode(const real *x, real *err, long long word,
+    struct thread_buffers *tb, const long long layer1_size) {
+  const int *point = &code_points[vocab_codes[word].points];
+  unsigned long long code = vocab_codes[word].code;
+  long long d, len = CodeLength(word);
+  for (d = 0; d < len; d++) {
+    tb->targets[d] = point[d];
+    tb->labels[d] = 1 - (real)((code >> d) & 1);
+  }
+  UpdateOutputRows(x, err, len, tb->targets, tb->labels, 1, tb, layer1_size);
+}
+
+// Negative sampling: word with label 1, then the next set of negatives, minus any that are the
+// word itself
+static inline __attribute__((always_inline)) void TrainNegatives(const real *x, real *err, long long word,
+    struct thread_buffers *tb, const long long layer1_size) {
+  long long d, n = 1, *negs = NextNegatives(tb, layer1_size);
+  tb->targets[0] = word;
+  for (d = 0; d < negative; d++) if (negs[d] != word) tb->targets[n++] = negs[d];
+  UpdateOutputRows(x, err, n, tb->targets, tb->neg_labels, 0, tb, layer1_size);
+}
+
+// Trains on every position of one sentence. layer1_size shadows the global so that the sized
+// copies below are compiled with a constant vector length.
+static inline __attribute__((always_inline)) void TrainSentenceSized(long long *sen, long long sentence_length,
+    struct thread_buffers *tb, unsigned long long *random, const long long layer1_size) {
+  long long a, b, cw, word, last_word, sentence_position;
+  long long l1, c;
+  unsigned long long next_random = *random;
+  real *neu1 = tb->neu1, *neu1e = tb->neu1e;
+
+  for (sentence_position = 0; sentence_position < sentence_length; sentence_position++) {
     word = sen[sentence_position];
     if (word == -1) continue;
     for (c = 0; c < layer1_size; c++) neu1[c] = neu1e[c] = 0;
+    if (prefetch) PrefetchPosition(sen, sentence_length, sentence_position, layer1_size);
     b = next_random % window;
     next_random = (next_random + 11) * (unsigned long long)25214903917;
 
     if (cbow) {  //train the cbow architecture
 //	struct vocab_word *vocword = &vocab[word];
-	struct vocab_code *voccode = &vocab_codes[word];
       // in -> hidden
       cw = 0;
       for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
@@ -580,67 +1358,19 @@ void *TrainModelThread(void *id) {
         last_word = sen[c];
         if (last_word == -1) continue;
 
-        for (c = 0; c < layer1_size; c++) neu1[c] += syn0[c + last_word * layer1_size];
+        if (storage == STORAGE_FP32) for (c = 0; c < layer1_size; c++) neu1[c] += syn0[c + last_word * layer1_size];
+        else AccumulateHalfRow(layer1_size, neu1, &syn0_half[last_word * layer1_size], storage);
 
         cw++;
       }
 
       if (cw) {
         for (c = 0; c < layer1_size; c++) neu1[c] /= cw;
-        if (hs) for (d = 0; d < voccode->codelen; d++) {
-          f = 0;
-          l2 = voccode->point[d] * layer1_size;
-
-          real *syn1_l2 = &syn1[l2]; 
-
-          // Propagate hidden -> output
-          //for (c = 0; c < layer1_size; c++) f += neu1[c] * syn1_l2[c];
-	f = DoMAC(layer1_size, neu1, syn1_l2);
-
-	f = getExp(f);
-
-          // 'g' is the gradient multiplied by the learning rate
-          g = (1 - voccode->code[d] - f) * alpha;
-	
-	// Propagate errors output -> hidden
-	DoMAC1(layer1_size, neu1e, g, syn1_l2);
-        // Learn weights hidden -> output
-	DoMAC1(layer1_size, syn1_l2, g, neu1);
-        }
+        // Propagate hidden -> output, errors output -> hidden and learn weights hidden -> output
+        if (hs) TrainCode(neu1, neu1e, word, tb, layer1_size);
 
         // NEGATIVE SAMPLING
-        if (negative > 0) for (d = 0; d < negative + 1; d++) {
-	  register long long next_target;
-          if (d == 0) {
-            target = word;
-            label = 1;
-            next_target = table[(next_random >> 16) % table_size];
-            next_random = (next_random + 11) * (unsigned long long)25214903917;
-          } else {
-            next_target = table[(next_random >> 16) % table_size];
-            next_random = (next_random + 11) * (unsigned long long)25214903917;
-            
-	    if (target == 0) target = next_random % (vocab_size - 1) + 1;
-
-            if (target == word) {
-	  	target = next_target;
-		continue;
-            }
-            label = 0;
-          }
-
-          l2 = target * layer1_size;
-          real *syn1neg_l2 = &syn1neg[l2]; 
-
-	  f = DoMAC(layer1_size, neu1, syn1neg_l2);
-
-	g = (label - getExp(f)) * alpha;
-
-	DoMAC1(layer1_size, neu1e, g, syn1neg_l2);
-	DoMAC1(layer1_size, syn1neg_l2, g, neu1);
-
-	target = next_target;
-        }
+        if (negative > 0) TrainNegatives(neu1, neu1e, word, tb, layer1_size);
 
         // hidden -> in
         for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
@@ -650,11 +1380,13 @@ void *TrainModelThread(void *id) {
           last_word = sen[c];
           if (last_word == -1) continue;
 
-          for (c = 0; c < layer1_size; c++) syn0[c + last_word * layer1_size] += neu1e[c];
+          AddToInputRow(last_word * layer1_size, neu1e, layer1_size, tb);
         }
+        tb->rows += 3 * cw + 2 * ((hs ? CodeLength(word) : 0) + ((negative > 0) ? negative + 1 : 0));
       }
+    } else if (batch_neg) {
+      TrainSkipGramBatch(sen, sentence_length, sentence_position, b, tb);
     } else {  //train skip-gram
-      register unsigned long long _next_random = next_random;
       for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
         c = sentence_position - window + a;
         if ((c < 0) || (c >= sentence_length)) continue;
@@ -663,102 +1395,933 @@ void *TrainModelThread(void *id) {
         if (last_word == -1) continue;
 
         l1 = last_word * layer1_size;
-        real *syn0_l1 = &syn0[l1]; 
+        real *syn0_l1 = LoadInputRow(l1, tb->in, layer1_size);
 
         for (c = 0; c < layer1_size; c++) neu1e[c] = 0;
 
         // HIERARCHICAL SOFTMAX
-        if (hs) {
-	 struct vocab_code *voccode = &vocab_codes[word];
-  	 for (d = 0; d < voccode->codelen; d++) {
-          l2 = voccode->point[d] * layer1_size;
-          real *syn1_l2 = &syn1[l2]; 
+        if (hs) TrainCode(syn0_l1, neu1e, word, tb, layer1_size);
+        // NEGATIVE SAMPLING
+        if (negative > 0) TrainNegatives(syn0_l1, neu1e, word, tb, layer1_size);
+        // Learn weights input -> hidden
+        AddToInputRow(l1, neu1e, layer1_size, tb);
+        tb->rows += 3 + 2 * ((hs ? CodeLength(word) : 0) + ((negative > 0) ? negative + 1 : 0));
+      }
+    }
+  }
+  *random = next_random;
+}
 
-          // Propagate hidden -> output
-	  f = DoMAC(layer1_size, syn0_l1, syn1_l2);
+// The common sizes get their own trainer, together with the kernels from SizedKernels()
+void (*TrainSentence)(long long *sen, long long sentence_length, struct thread_buffers *tb, unsigned long long *random);
 
-	  f = getExp(f);
+#define SIZED_TRAINER(size) \
+void TrainSentence##size(long long *sen, long long sentence_length, struct thread_buffers *tb, unsigned long long *random) { \
+  TrainSentenceSized(sen, sentence_length, tb, random, size); \
+}
 
-          // 'g' is the gradient multiplied by the learning rate
-          g = (1 - voccode->code[d] - f) * alpha;
-	  DoMAC1(layer1_size, neu1e, g, syn1_l2);
-	  DoMAC1(layer1_size, syn1_l2, g, syn0_l1);
-        }
-       }
-        // NEGATIVE SAMPLING
-        if (negative > 0) {
-         register long long next_target;
-	 for (d = 0; d < negative + 1; d++) {
-          if (d == 0) {
-            target = word;
-            label = 1;
-            next_target = table[(_next_random >> 16) % table_size];
-            _next_random = (_next_random + 11) * (unsigned long long)25214903917;
-          } else {
-            next_target = table[(_next_random >> 16) % table_size];
-            _next_random = (_next_random + 11) * (unsigned long long)25214903917;
-
-            if (target == 0) target = _next_random % (vocab_size - 1) + 1;
-            if (target == word) {
-	  	target = next_target;
-		continue;
-            }
-            label = 0;
-          }
-          l2 = target * layer1_size;
-          real *syn1neg_l2 = &syn1neg[l2]; 
-
-	  f = DoMAC(layer1_size, syn0_l1, syn1neg_l2);
-      
-	  g = (label - getExp(f)) * alpha;
-	  DoMAC1(layer1_size, neu1e, g, syn1neg_l2);
-	  DoMAC1(layer1_size, syn1neg_l2, g, syn0_l1);
-	  target = next_target;
+SIZED_TRAINER(100)
+SIZED_TRAINER(128)
+SIZED_TRAINER(200)
+SIZED_TRAINER(256)
+SIZED_TRAINER(300)
+SIZED_TRAINER(512)
+
+void TrainSentenceAny(long long *sen, long long sentence_length, struct thread_buffers *tb, unsigned long long *random) {
+  TrainSentenceSized(sen, sentence_length, tb, random, layer1_size);
+}
+
+struct sized_trainer {
+  long long size;
+  void (*train)(long long *sen, long long sentence_length, struct thread_buffers *tb, unsigned long long *random);
+} sized_trainers[] = {
+  {100, TrainSentence100}, {128, TrainSentence128}, {200, TrainSentence200},
+  {256, TrainSentence256}, {300, TrainSentence300}, {512, TrainSentence512},
+};
+
+void SelectTrainer() {
+  int a;
+  TrainSentence = TrainSentenceAny;
+  for (a = 0; a < sizeof(sized_trainers) / sizeof(sized_trainers[0]); a++) {
+    if (sized_trainers[a].size == layer1_size) TrainSentence = sized_trainers[a].train;
+  }
+}
+
+// A thread's position in the training data: the mapped text, or the -train-encoded stream
+struct train_reader {
+  struct token_reader tr;
+  long long pos;
+  int eof;
+};
+
+void SeekTrainReader(struct train_reader *r, long long pos) {
+  r->eof = 0;
+  if (encoded_data != NULL) r->pos = SeekEncoded(encoded_data, file_size, pos);
+  else InitTokenReader(&r->tr, train_data, file_size, pos, MAX_STRING - 1);
+}
+
+static inline long long TrainReaderPos(struct train_reader *r) {
+  return (encoded_data != NULL) ? r->pos : r->tr.pos;
+}
+
+// The first sentence start after pos, for the chunk boundaries: just past the next newline of the
+// text, or the next </s> token of the encoded stream
+long long AlignToSentence(long long pos) {
+  const char *nl;
+  if (encoded_data != NULL) {
+    pos = SeekEncoded(encoded_data, file_size, pos);
+    while ((pos < file_size) && (ReadEncodedIndex(encoded_data, &pos) != 0));
+    return pos;
+  }
+  nl = (const char *)memchr(train_data + pos, '\n', file_size - pos);
+  return (nl == NULL) ? file_size : nl - train_data + 1;
+}
+
+// Returns the vocabulary index of the next word, or -1 if it is unknown or the data ended (eof is set)
+static inline long long ReadTrainIndex(struct train_reader *r) {
+  struct token tok;
+  if (encoded_data != NULL) {
+    if (r->pos < file_size) return ReadEncodedIndex(encoded_data, &r->pos);
+  } else {
+    if (ReadToken(&r->tr, &tok)) return SearchToken(&tok);
+  }
+  r->eof = 1;
+  return -1;
+}
+
+// Reads one sentence into sen[] with subsampling applied and returns its length.
+// word_count is advanced by every in-vocabulary word read, kept or not.
+long long ReadSentence(struct train_reader *r, long long *sen, long long *word_count, unsigned long long *next_random) {
+  long long word, sentence_length = 0;
+  real ran;
+  while (1) {
+    word = ReadTrainIndex(r);
+    if (r->eof) break;
+    if (word == -1) continue;
+    (*word_count)++;
+    if (word == 0) break;
+    // The subsampling randomly discards frequent words while keeping the ranking same
+    if (sample > 0) {
+      *next_random = (*next_random + 11) * (unsigned long long)25214903917;
+      ran = (sqrt(GetWordUsageI(word) / (sample * vocab_words)) + 1) * (sample * vocab_words) / GetWordUsageI(word);
+      if (ran < (*next_random & 0xFFFF) / (real)65536) continue;
+    }
+    sen[sentence_length] = word;
+    sentence_length++;
+    if (sentence_length >= MAX_SENTENCE_LENGTH) break;
+  }
+  return sentence_length;
+}
+
+// Adds finished words to the global progress, reports it and decays the learning rate
+void UpdateProgress(long long words) {
+  clock_t now;
+  if (shared != NULL) word_count_actual = __atomic_add_fetch(&shared->word_count, words, __ATOMIC_RELAXED);
+  else word_count_actual += words;
+  if ((debug_mode > 1)) {
+    now=clock();
+    printf("%cAlpha: %f  Progress: %.2f%%  Words/thread/sec: %.2fk  ", 13, alpha,
+     word_count_actual / (real)(iter * train_words + 1) * 100,
+     word_count_actual / ((real)(now - start + 1) / (real)CLOCKS_PER_SEC * 1000));
+    if (num_readers > 0) printf("Queue: %3lld%%  ", RingCount(&full_batches) * 100 / (full_batches.mask + 1));
+    fflush(stdout);
+  }
+  alpha = starting_alpha * (1 - word_count_actual / (real)(iter * train_words + 1));
+  if (alpha < starting_alpha * 0.0001) alpha = starting_alpha * 0.0001;
+}
+
+static int WriteAll(int fd, const void *p, long long bytes) {
+  const char *c = (const char *)p;
+  long long n;
+  while (bytes > 0) {
+    n = write(fd, c, (bytes < (1LL << 30)) ? bytes : (1LL << 30));
+    if (n <= 0) return 0;
+    c += n;
+    bytes -= n;
+  }
+  return 1;
+}
+
+// The weight arrays of a checkpoint in file order, as stored; returns how many there are
+int CheckpointArrays(void **arrays, long long *bytes) {
+  long long matrix = (long long)vocab_size * layer1_size;
+  int n = 0;
+  if (storage != STORAGE_FP32) {arrays[n] = syn0_half; bytes[n++] = matrix * sizeof(unsigned short);}
+  else {arrays[n] = syn0; bytes[n++] = matrix * sizeof(real);}
+  if (hs) {arrays[n] = syn1; bytes[n++] = matrix * sizeof(real);}
+  if ((negative > 0) && (storage != STORAGE_FP32)) {arrays[n] = syn1neg_half; bytes[n++] = matrix * sizeof(unsigned short);}
+  else if (negative > 0) {arrays[n] = syn1neg; bytes[n++] = matrix * sizeof(real);}
+  return n;
+}
+
+// Writes a checkpoint to tmp, then renames it to path so that a complete one is always there.
+// Runs in the forked child, where the other threads do not exist: system calls only, no stdio.
+int WriteCheckpoint(const struct checkpoint_header *h, const struct finished_chunk *finished, const char *tmp,
+                    const char *path) {
+  void *arrays[3];
+  long long bytes[3];
+  int a, n = CheckpointArrays(arrays, bytes), ok, fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return 0;
+  ok = WriteAll(fd, h, sizeof(*h)) && WriteAll(fd, finished, h->num_finished * sizeof(*finished));
+  for (a = 0; a < n; a++) ok = ok && WriteAll(fd, arrays[a], bytes[a]);
+  ok = ok && (fsync(fd) == 0);
+  ok = (close(fd) == 0) && ok;
+  return ok && (rename(tmp, path) == 0);
+}
+
+// Reaps the child that writes the last checkpoint, waiting for it if wait is set. Returns 0 if
+// it is still running.
+int ReapCheckpoint(int wait) {
+  int status;
+  if (checkpoint_pid <= 0) return 1;
+  if (waitpid(checkpoint_pid, &status, wait ? 0 : WNOHANG) == 0) return 0;
+  if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) printf("\nWARNING: writing the checkpoint in %s failed\n", checkpoint_dir);
+  else if (debug_mode > 0) printf("\nCheckpoint: %lld of %lld chunks done\n", checkpoint_chunks, schedule.epochs * schedule.num_chunks);
+  checkpoint_pid = 0;
+  return 1;
+}
+
+// Snapshots the weights together with the finished part of the schedule. A forked child writes
+// them: it sees the memory as it was at the fork, copied on write, while the trainers go on.
+// Returns 0 if the last checkpoint is still being written.
+int SaveCheckpoint() {
+  struct checkpoint_header h;
+  char tmp[MAX_STRING + 32], path[MAX_STRING + 32];
+  pid_t pid;
+  if (!ReapCheckpoint(0)) return 0;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+  h.vocab_checksum = GetVocabChecksum();
+  h.vocab_size = vocab_size;
+  h.layer1_size = layer1_size;
+  h.file_size = file_size;
+  h.cbow = cbow;
+  h.window = window;
+  h.hs = hs;
+  h.negative = negative;
+  h.batch_neg = batch_neg;
+  h.storage = storage;
+  h.sample = sample;
+  h.train_words = train_words;
+  h.init_words = init_words;
+  h.iter = iter;
+  h.num_chunks = schedule.num_chunks;
+  h.starting_alpha = starting_alpha;
+  if (checkpoint_finished == NULL) {
+    checkpoint_finished = (struct finished_chunk *)malloc(schedule.epochs * schedule.num_chunks * sizeof(struct finished_chunk));
+    if (checkpoint_finished == NULL) {
+      printf("Memory allocation failed\n");
+      exit(1);
+    }
+  }
+  h.chunks_done = ChunksDone(&schedule, &h.words_done);
+  h.num_finished = ChunksFinished(&schedule, checkpoint_finished);
+  if (h.chunks_done + h.num_finished == checkpoint_chunks) return 1;  // Nothing new
+  checkpoint_chunks = h.chunks_done + h.num_finished;
+  snprintf(tmp, sizeof(tmp), "%s/checkpoint.tmp", checkpoint_dir);
+  snprintf(path, sizeof(path), "%s/checkpoint", checkpoint_dir);
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) _exit(WriteCheckpoint(&h, checkpoint_finished, tmp, path) ? 0 : 1);
+  if (pid > 0) {
+    checkpoint_pid = pid;
+    return 1;
+  }
+  // Without a child the weights are written while they change, which Hogwild training tolerates
+  if (!WriteCheckpoint(&h, checkpoint_finished, tmp, path)) printf("\nWARNING: writing the checkpoint in %s failed\n", checkpoint_dir);
+  return 1;
+}
+
+// Shared run, coordinator: hands the work of dead workers out again and ends the run once every
+// chunk is finished. Worker: stops if it was declared dead or the coordinator went silent.
+void TendSharedRun() {
+  struct shared_worker *w = shared->workers;
+  long long words, returned;
+  int dead;
+  Heartbeat(&w[worker_id]);
+  if (worker_id != 0) {
+    if (__atomic_load_n(&w[worker_id].state, __ATOMIC_ACQUIRE) != WORKER_ALIVE) {
+      printf("\nERROR: this worker was declared dead after %d seconds without a heartbeat\n", worker_timeout);
+      exit(1);
+    }
+    if (MonotonicNs() - __atomic_load_n(&w[0].heartbeat, __ATOMIC_RELAXED) > worker_timeout * 1000000000LL) {
+      printf("\nERROR: the coordinator of %s stopped\n", attach_name);
+      exit(1);
+    }
+    return;
+  }
+  while ((dead = FindDeadWorker(w, worker_id, worker_timeout)) >= 0) {
+    returned = ReturnChunks(&schedule, dead);
+    printf("\nWorker %d (pid %d) stopped; %lld of its chunks are handed out again\n", dead, w[dead].pid, returned);
+    FreeWorker(&w[dead], &shared->lock);
+  }
+  if (ChunksDone(&schedule, &words) == schedule.epochs * schedule.num_chunks) {
+    __atomic_store_n(&shared->complete, 1, __ATOMIC_RELEASE);
+  }
+}
+
+// Waits for the trainers to finish, and in a shared run for the whole run to end. Meanwhile
+// starts a checkpoint every checkpoint_every minutes and keeps up the worker table.
+void WaitForTrainers() {
+  struct timespec last, now;
+  clock_gettime(CLOCK_MONOTONIC, &last);
+  while ((__atomic_load_n(&trainers_running, __ATOMIC_ACQUIRE) > 0) ||
+         ((shared != NULL) && !__atomic_load_n(&shared->complete, __ATOMIC_ACQUIRE))) {
+    usleep(100000);
+    if (shared != NULL) TendSharedRun();
+    if (checkpoint_dir[0] == 0) continue;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - last.tv_sec + (now.tv_nsec - last.tv_nsec) * 1e-9 < checkpoint_every * 60) continue;
+    if (SaveCheckpoint()) last = now;
+  }
+  ReapCheckpoint(1);
+}
+
+// -resume: the schedule options come from the checkpoint, so that the run goes on with the same
+// chunk order and learning rate, and so do the chunks it had finished; LoadCheckpoint() reads the
+// weights once they are allocated
+void ReadCheckpointHeader() {
+  const struct checkpoint_header *h = &resume_header;
+  char path[MAX_STRING + 32];
+  long long a, entries;
+  FILE *fin;
+  snprintf(path, sizeof(path), "%s/checkpoint", checkpoint_dir);
+  fin = fopen(path, "rb");
+  if ((fin == NULL) || (fread(&resume_header, sizeof(resume_header), 1, fin) != 1) ||
+      memcmp(resume_header.magic, CHECKPOINT_MAGIC, sizeof(resume_header.magic))) {
+    printf("ERROR: no checkpoint to resume from in %s\n", checkpoint_dir);
+    exit(1);
+  }
+  entries = h->iter * h->num_chunks;
+  if ((h->chunks_done < 0) || (h->num_finished < 0) || (h->chunks_done + h->num_finished > entries)) {
+    printf("ERROR: %s is corrupt\n", path);
+    exit(1);
+  }
+  resume_finished = (struct finished_chunk *)malloc((h->num_finished + 1) * sizeof(struct finished_chunk));
+  if (resume_finished == NULL) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  if (fread(resume_finished, sizeof(struct finished_chunk), h->num_finished, fin) != h->num_finished) {
+    printf("ERROR: %s is truncated\n", path);
+    exit(1);
+  }
+  for (a = 0; a < h->num_finished; a++) {
+    if ((resume_finished[a].entry < h->chunks_done) || (resume_finished[a].entry >= entries)) {
+      printf("ERROR: %s is corrupt\n", path);
+      exit(1);
+    }
+  }
+  fclose(fin);
+  iter = resume_header.iter;
+  num_chunks = resume_header.num_chunks;
+  alpha = resume_header.starting_alpha;
+}
+
+void LoadCheckpoint() {
+  const struct checkpoint_header *h = &resume_header;
+  char path[MAX_STRING + 32];
+  void *arrays[3];
+  long long bytes[3];
+  int a, n = CheckpointArrays(arrays, bytes);
+  FILE *fin;
+  if ((h->vocab_size != vocab_size) || (h->vocab_checksum != GetVocabChecksum()) || (h->file_size != file_size)) {
+    printf("ERROR: the checkpoint in %s was made with a different vocabulary or training file\n", checkpoint_dir);
+    exit(1);
+  }
+  if ((h->layer1_size != layer1_size) || (h->cbow != cbow) || (h->window != window) || (h->hs != hs) ||
+      (h->negative != negative) || (h->batch_neg != batch_neg) || (h->storage != storage) || (h->sample != sample)) {
+    printf("ERROR: the checkpoint in %s needs the -size, -cbow, -window, -hs, -negative, -batch-neg, -storage and -sample it was made with\n", checkpoint_dir);
+    exit(1);
+  }
+  snprintf(path, sizeof(path), "%s/checkpoint", checkpoint_dir);
+  fin = fopen(path, "rb");
+  if (fin == NULL) {
+    printf("ERROR: cannot read %s\n", path);
+    exit(1);
+  }
+  fseek(fin, sizeof(*h) + h->num_finished * sizeof(struct finished_chunk), SEEK_SET);
+  for (a = 0; a < n; a++) if (fread(arrays[a], 1, bytes[a], fin) != bytes[a]) {
+    printf("ERROR: %s is truncated\n", path);
+    exit(1);
+  }
+  fclose(fin);
+  if (debug_mode > 0) {
+    printf("Resuming after %lld of %lld chunks, %lld words, and %lld chunks finished later\n", h->chunks_done,
+           h->iter * h->num_chunks, h->words_done, h->num_finished);
+  }
+}
+
+// Takes the next chunk of the schedule. In a shared run threads wait at the end instead of
+// stopping, as the chunks of a worker that dies are handed out again.
+long long TakeChunk(long long *begin, long long *end) {
+  long long k;
+  while (((k = NextChunk(&schedule, worker_id, begin, end)) < 0) && (shared != NULL) &&
+         !__atomic_load_n(&shared->complete, __ATOMIC_ACQUIRE)) usleep(100000);
+  return k;
+}
+
+void *TrainModelThread(void *id) {
+  long long sentence_length, word_count = 0, last_word_count = 0, sen[MAX_SENTENCE_LENGTH + 1];
+  long long begin, end, k, chunk_start;
+  unsigned long long next_random = ThreadSeed((long long)id);
+  struct train_reader reader;
+  struct thread_buffers tb;
+
+  AllocThreadBuffers(&tb, (long long)id);
+  memset(sen, 0, sizeof(sen));
+  while ((k = TakeChunk(&begin, &end)) >= 0) {
+    SeekTrainReader(&reader, begin);
+    chunk_start = word_count;
+    while (TrainReaderPos(&reader) < end) {
+      if (word_count - last_word_count > 10000) {
+        UpdateProgress(word_count - last_word_count);
+        last_word_count = word_count;
+      }
+      sentence_length = ReadSentence(&reader, sen, &word_count, &next_random);
+      if (reader.eof) break;
+      TrainSentence(sen, sentence_length, &tb, &next_random);
+      if (hot_rows > 0) HotRowsTrained(&tb, sentence_length);
+    }
+    if (hot_rows > 0) MergeHotRows(&tb);  // A finished chunk has all of its updates in the weights
+    FinishChunk(&schedule, k, word_count - chunk_start);
+  }
+  UpdateProgress(word_count - last_word_count);
+  FreeThreadBuffers(&tb);
+  __atomic_sub_fetch(&trainers_running, 1, __ATOMIC_RELEASE);
+  pthread_exit(NULL);
+}
+
+// Pipeline mode (-readers): reader threads turn the corpus into batches of subsampled sentences
+// and trainer threads only run the updates. Batches cycle between two lock-free queues.
+void *ReaderThread(void *id) {
+  long long length, word_count = 0, last_word_count = 0, begin, end, k, chunk_start;
+  long long blocked = 0, pushes = 0;
+  unsigned long long next_random = ThreadSeed((long long)id);
+  struct train_reader reader;
+  struct sentence_batch *batch = NULL;
+
+  if (numa) PinThreadToNode(&topology, (long long)id % topology.num_nodes);
+  while ((k = TakeChunk(&begin, &end)) >= 0) {
+    SeekTrainReader(&reader, begin);
+    chunk_start = word_count;
+    if (batch != NULL) batch->chunk = k;  // Still empty
+    while (1) {
+      while (batch == NULL) {
+        batch = (struct sentence_batch *)RingPop(&free_batches);
+        if (batch == NULL) {
+          blocked++;
+          sched_yield();
+        } else {
+          batch->count = batch->words = 0;
+          batch->chunk = k;
         }
-        // Learn weights input -> hidden
-	DoAdd(layer1_size, syn0_l1, neu1e);
-//        for (c = 0; c < layer1_size; c++) syn0[c + l1] += neu1e[c];
-       }
       }
-      next_random = _next_random + 11;
+      if (reader.eof || (TrainReaderPos(&reader) >= end)) break;
+      length = ReadSentence(&reader, batch->sen + batch->offset[batch->count], &word_count, &next_random);
+      batch->words += word_count - last_word_count;
+      last_word_count = word_count;
+      if (reader.eof) continue;
+      batch->offset[batch->count + 1] = batch->offset[batch->count] + length;
+      batch->count++;
+      if ((batch->offset[batch->count] >= BATCH_WORDS) || (batch->count == BATCH_SENTENCES)) {
+        HoldChunk(&schedule, k);
+        while (!RingPush(&full_batches, batch)) sched_yield();
+        pushes++;
+        batch = NULL;
+      }
+    }
+    // Batches do not span chunks, so that a chunk is finished once its batches are trained.
+    // The partial batch goes too, it may carry the word count of sentences it has no room for.
+    if (batch->words > 0) {
+      HoldChunk(&schedule, k);
+      while (!RingPush(&full_batches, batch)) sched_yield();
+      pushes++;
+      batch = NULL;
+    }
+    FinishChunk(&schedule, k, word_count - chunk_start);
+  }
+  if (batch != NULL) while (!RingPush(&free_batches, batch)) sched_yield();
+  __atomic_add_fetch(&reader_blocked, blocked, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&reader_pushes, pushes, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&readers_running, 1, __ATOMIC_RELEASE);
+  pthread_exit(NULL);
+}
+
+void *PipelineTrainThread(void *id) {
+  long long a, words = 0, starved = 0, pops = 0, occupancy = 0;
+  unsigned long long next_random = ThreadSeed((long long)id);
+  struct sentence_batch *batch;
+  struct thread_buffers tb;
+
+  AllocThreadBuffers(&tb, (long long)id);
+  while (1) {
+    occupancy += RingCount(&full_batches);
+    batch = (struct sentence_batch *)RingPop(&full_batches);
+    if (batch == NULL) {
+      // Readers push their last batch before they stop, so look once more after they are done
+      if (__atomic_load_n(&readers_running, __ATOMIC_ACQUIRE) == 0) {
+        batch = (struct sentence_batch *)RingPop(&full_batches);
+        if (batch == NULL) break;
+      } else {
+        starved++;
+        sched_yield();
+        continue;
+      }
     }
-    sentence_position++;
-    if (sentence_position >= sentence_length) {
-      sentence_length = 0;
-      continue;
+    pops++;
+    words += batch->words;
+    if (words > 10000) {
+      UpdateProgress(words);
+      words = 0;
     }
+    for (a = 0; a < batch->count; a++) {
+      TrainSentence(batch->sen + batch->offset[a], batch->offset[a + 1] - batch->offset[a], &tb, &next_random);
+      if (hot_rows > 0) HotRowsTrained(&tb, batch->offset[a + 1] - batch->offset[a]);
+    }
+    if (hot_rows > 0) MergeHotRows(&tb);
+    ReleaseChunk(&schedule, batch->chunk);
+    while (!RingPush(&free_batches, batch)) sched_yield();
   }
-  fclose(fi);
-  free(neu1);
-  free(neu1e);
+  UpdateProgress(words);
+  __atomic_add_fetch(&trainer_starved, starved, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&trainer_pops, pops, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&queue_occupancy, occupancy, __ATOMIC_RELAXED);
+  FreeThreadBuffers(&tb);
+  __atomic_sub_fetch(&trainers_running, 1, __ATOMIC_RELEASE);
   pthread_exit(NULL);
 }
 
+void TrainPipeline() {
+  long a, queue_size = 16;
+  pthread_t *pr = (pthread_t *)malloc(num_readers * sizeof(pthread_t));
+  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  struct sentence_batch *batches;
+
+  while (queue_size < 4 * (num_readers + num_threads)) queue_size *= 2;
+  InitRing(&full_batches, queue_size);
+  InitRing(&free_batches, queue_size);
+  batches = (struct sentence_batch *)malloc(queue_size * sizeof(struct sentence_batch));
+  if (batches == NULL) {printf("Memory allocation failed\n"); exit(1);}
+  for (a = 0; a < queue_size; a++) {
+    batches[a].offset[0] = 0;
+    RingPush(&free_batches, &batches[a]);
+  }
+  readers_running = num_readers;
+  for (a = 0; a < num_readers; a++) pthread_create(&pr[a], NULL, ReaderThread, (void *)a);
+  for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, PipelineTrainThread, (void *)a);
+  if ((checkpoint_dir[0] != 0) || (shared != NULL)) WaitForTrainers();
+  for (a = 0; a < num_readers; a++) pthread_join(pr[a], NULL);
+  for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+  if (debug_mode > 0) {
+    // A full queue means trainers are the bottleneck; an empty one means the readers are
+    printf("\nPipeline: %d readers, %d trainers, %ld batches\n", num_readers, num_threads, queue_size);
+    printf("Average queue occupancy: %.1f%%\n", queue_occupancy * 100.0 / (trainer_pops + trainer_starved + 1) / queue_size);
+    printf("Trainers found the queue empty: %.1f%% of polls\n", trainer_starved * 100.0 / (trainer_pops + trainer_starved + 1));
+    printf("Readers found no free batch: %.1f%% of polls\n", reader_blocked * 100.0 / (reader_pushes + reader_blocked + 1));
+  }
+  FreeRing(&full_batches);
+  FreeRing(&free_batches);
+  free(batches);
+  free(pr);
+  free(pt);
+}
+
+// Where the weight pages ended up and how much weight traffic the threads of every node caused
+void ReportNuma(double seconds) {
+  long long pages[NUMA_MAX_NODES], total = 0, matrix = (long long)vocab_size * layer1_size;
+  long long row_bytes = layer1_size * ((storage == STORAGE_FP32) ? sizeof(real) : sizeof(unsigned short));
+  int n;
+  memset(pages, 0, sizeof(pages));
+  if (syn0 != NULL) CountMemoryNodes(&topology, syn0, matrix * sizeof(real), pages);
+  if (syn0_half != NULL) CountMemoryNodes(&topology, syn0_half, matrix * sizeof(unsigned short), pages);
+  if (syn1 != NULL) CountMemoryNodes(&topology, syn1, matrix * sizeof(real), pages);
+  if (syn1neg != NULL) CountMemoryNodes(&topology, syn1neg, matrix * sizeof(real), pages);
+  if (syn1neg_half != NULL) CountMemoryNodes(&topology, syn1neg_half, matrix * sizeof(unsigned short), pages);
+  for (n = 0; n < topology.num_nodes; n++) total += pages[n];
+  printf("\nNUMA: %d nodes, %d CPUs\n", topology.num_nodes, topology.num_cpus);
+  for (n = 0; n < topology.num_nodes; n++) {
+    printf("Node %d: %lld trainer threads, %.1f%% of weight pages, %.2f GB/s of weight rows read or written\n",
+           topology.node_ids[n], node_threads[n], total ? pages[n] * 100.0 / total : 0.0,
+           node_rows[n] * row_bytes / seconds / 1e9);
+  }
+}
+
+// How much of the output row traffic -hot-rows kept in the threads. Without replicas every update
+// of a hot row is a write to a line that the other threads keep reading and writing too.
+void ReportHotRows(double seconds) {
+  printf("\nHot rows: %lld replicated in %d threads, %.1f%% of %lld output row updates\n", hot_rows, num_threads,
+         hot_updates * 100.0 / (output_updates + 1), output_updates);
+  printf("Writes to shared hot rows: %lld by merges instead of %lld, %.1fx fewer (%.0f instead of %.0f per second)\n",
+         hot_merged, hot_updates, hot_updates / (hot_merged + 1.0), hot_merged / seconds, hot_updates / seconds);
+}
+
+// Coordinator: creates the segment of a shared run with the vocabulary and the settings that the
+// workers need, the chunk schedule state and the weights
+void CreateSharedRun() {
+  struct shared_run h;
+  long long matrix = (long long)vocab_size * layer1_size, huge = 1 << 21, offset;
+  long long weight = (storage != STORAGE_FP32) ? sizeof(unsigned short) : sizeof(real);
+  char *blob = NULL;
+  size_t blob_bytes = 0;
+  FILE *fo = open_memstream(&blob, &blob_bytes);
+  WriteVocab(fo);
+  fclose(fo);
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SHARED_MAGIC, sizeof(h.magic));
+  h.vocab_size = vocab_size;
+  h.layer1_size = layer1_size;
+  h.train_words = train_words;
+  h.vocab_words = vocab_words;
+  h.file_size = file_size;
+  h.iter = iter;
+  h.num_chunks = num_chunks;
+  h.min_count = min_count;
+  h.cbow = cbow;
+  h.window = window;
+  h.hs = hs;
+  h.negative = negative;
+  h.batch_neg = batch_neg;
+  h.storage = storage;
+  h.stochastic_round = stochastic_round;
+  h.sample = sample;
+  h.starting_alpha = starting_alpha;
+  h.vocab_checksum = GetVocabChecksum();
+  strcpy(h.train_file, train_file);
+  strcpy(h.train_encoded_file, train_encoded_file);
+  offset = sizeof(h);
+  h.vocab_offset = offset;
+  h.vocab_bytes = blob_bytes;
+  offset = (offset + blob_bytes + 63) & ~63LL;
+  h.schedule_offset = offset;
+  offset = (offset + ChunkStateSize(iter * num_chunks) + huge - 1) & ~(huge - 1);
+  h.syn0_offset = offset;
+  offset += (matrix * weight + huge - 1) & ~(huge - 1);
+  if (hs) {
+    h.syn1_offset = offset;
+    offset += (matrix * sizeof(real) + huge - 1) & ~(huge - 1);
+  }
+  if (negative > 0) {
+    h.syn1neg_offset = offset;
+    offset += matrix * weight;
+  }
+  h.bytes = offset;
+  shared = (struct shared_run *)CreateSharedMemory(shm_name, h.bytes);
+  if (shared == NULL) {
+    printf("ERROR: cannot create the shared memory segment %s of %lld MB\n", shm_name, h.bytes >> 20);
+    exit(1);
+  }
+  memcpy(shared, &h, sizeof(h));
+  memcpy((char *)shared + h.vocab_offset, blob, blob_bytes);
+  free(blob);
+  InitSharedMutex(&shared->lock);
+  worker_id = JoinWorkers(shared->workers, &shared->lock);
+  if (debug_mode > 0) printf("Shared run %s: %lld MB; add workers with -attach %s\n", shm_name, h.bytes >> 20, shm_name);
+}
+
+// Worker: maps the run that a coordinator created with -shm and takes over its settings, waiting
+// for it to be set up
+void AttachSharedRun() {
+  long long bytes, waited = 0;
+  while (1) {
+    shared = (struct shared_run *)AttachSharedMemory(attach_name, &bytes);
+    if ((shared != NULL) && ((bytes < sizeof(*shared)) || memcmp(shared->magic, SHARED_MAGIC, sizeof(shared->magic)))) {
+      printf("ERROR: %s is not a training run\n", attach_name);
+      exit(1);
+    }
+    if ((shared != NULL) && __atomic_load_n(&shared->ready, __ATOMIC_ACQUIRE)) break;
+    if ((shared == NULL) && (waited++ >= worker_timeout * 10)) {
+      printf("ERROR: there is no training run called %s\n", attach_name);
+      exit(1);
+    }
+    if (shared != NULL) munmap(shared, bytes);
+    usleep(100000);
+  }
+#ifdef CONST_LAYER1
+  if (shared->layer1_size != layer1_size) {
+    printf("ERROR: the run %s has -size %lld, this build %lld\n", attach_name, shared->layer1_size, (long long)layer1_size);
+    exit(1);
+  }
+#else
+  layer1_size = shared->layer1_size;
+#endif
+  iter = shared->iter;
+  num_chunks = shared->num_chunks;
+  min_count = shared->min_count;
+  cbow = shared->cbow;
+  window = shared->window;
+  hs = shared->hs;
+  negative = shared->negative;
+  batch_neg = shared->batch_neg;
+  stochastic_round = shared->stochastic_round;
+  strcpy(storage_name, (shared->storage == STORAGE_BF16) ? "bf16" : (shared->storage == STORAGE_FP16) ? "fp16" : "fp32");
+  sample = shared->sample;
+  alpha = starting_alpha = shared->starting_alpha;
+  if (train_file[0] == 0) strcpy(train_file, shared->train_file);
+  strcpy(train_encoded_file, shared->train_encoded_file);
+  checkpoint_dir[0] = 0;  // The coordinator's business
+}
+
+// What a cached vocabulary depends on: the files it is counted from, with their sizes and
+// modification times, and the options that change it
+void VocabCacheKey(char *key) {
+  const char *files[2];
+  struct stat st;
+  int a, n;
+  files[0] = (read_vocab_file[0] != 0) ? read_vocab_file : train_file;
+  files[1] = init_vocab_file;
+  memset(key, 0, VOCAB_CACHE_KEY);
+  n = snprintf(key, VOCAB_CACHE_KEY, "min-count %d vocab-memory %lld", min_count, vocab_memory);
+  for (a = 0; a < 2; a++) {
+    if ((files[a][0] == 0) || (n >= VOCAB_CACHE_KEY)) continue;
+    if (stat(files[a], &st) != 0) memset(&st, 0, sizeof(st));
+    n += snprintf(key + n, VOCAB_CACHE_KEY - n, " %s %lld %lld.%09ld", files[a], (long long)st.st_size,
+                  (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+  }
+}
+
+static long long CacheAlign(long long offset) {
+  return (offset + 63) & ~63LL;
+}
+
+// Hash release for a cached vocabulary: its slots live inside the read-only cache mapping and are
+// never freed on their own
+static void ReleaseMapped(void *p) {
+}
+
+// Builds the Huffman codes and the unigram table, whether this run needs them or not, and writes
+// the vocabulary with them to vocab_cache_file. The file is written under another name and renamed,
+// so that runs started at the same time never map half of one.
+void WriteVocabCache() {
+  struct vocab_cache_header h;
+  char tmp[MAX_STRING + 32];
+  const void *parts[6];
+  long long sizes[6], offsets[6], offset;
+  int a, fd, ok;
+  CreateBinaryTree();
+  InitUnigramTable();
+  vocab_tables = 1;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, VOCAB_CACHE_MAGIC, sizeof(h.magic));
+  VocabCacheKey(h.key);
+  h.vocab_size = vocab_size;
+  h.train_words = train_words;
+  h.vocab_words = vocab_words;
+  h.init_words = init_words;
+  h.hash_bits = vocab_hash.bits;
+  h.hash_count = vocab_hash.count;
+  h.strings_bytes = vocab_strings.size;
+  h.points = vocab_codes[vocab_size].points;
+  parts[0] = vocab;
+  sizes[0] = vocab_size * sizeof(struct vocab_word);
+  parts[1] = vocab_strings.data;
+  sizes[1] = vocab_strings.size;
+  parts[2] = vocab_hash.slots;
+  sizes[2] = (vocab_hash.mask + 1) * sizeof(struct hash_slot);
+  parts[3] = vocab_codes;
+  sizes[3] = (vocab_size + 1) * sizeof(struct vocab_code);
+  parts[4] = code_points;
+  sizes[4] = h.points * sizeof(int);
+  parts[5] = unigram.entries;
+  sizes[5] = vocab_size * sizeof(struct alias_entry);
+  offset = CacheAlign(sizeof(h));
+  for (a = 0; a < 6; a++) {
+    offsets[a] = offset;
+    offset = CacheAlign(offset + sizes[a]);
+  }
+  h.vocab_offset = offsets[0];
+  h.strings_offset = offsets[1];
+  h.hash_offset = offsets[2];
+  h.codes_offset = offsets[3];
+  h.points_offset = offsets[4];
+  h.unigram_offset = offsets[5];
+  h.bytes = offset;
+  snprintf(tmp, sizeof(tmp), "%s.tmp%d", vocab_cache_file, (int)getpid());
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ok = (fd >= 0) && WriteAll(fd, &h, sizeof(h));
+  for (a = 0; (a < 6) && ok; a++) ok = (lseek(fd, offsets[a], SEEK_SET) == offsets[a]) && WriteAll(fd, parts[a], sizes[a]);
+  if (ok) ok = (ftruncate(fd, h.bytes) == 0);
+  if (fd >= 0) close(fd);
+  if (ok) ok = (rename(tmp, vocab_cache_file) == 0);
+  if (!ok) {
+    unlink(tmp);
+    printf("WARNING: cannot write the vocabulary cache %s\n", vocab_cache_file);
+  } else if (debug_mode > 0) printf("Vocabulary cache written to %s: %lld KB\n", vocab_cache_file, h.bytes / 1024);
+}
+
+// Maps vocab_cache_file and points the vocabulary, its hash table, the Huffman codes and the
+// unigram table into it. Returns 0 if there is no cache, or one built from other inputs, which
+// WriteVocabCache() then replaces. The mapping is private: nothing is written back, and the
+// vocabulary must not grow any more.
+int ReadVocabCache() {
+  struct vocab_cache_header h;
+  char key[VOCAB_CACHE_KEY];
+  struct stat st;
+  char *base;
+  int fd = open(vocab_cache_file, O_RDONLY);
+  if (fd < 0) return 0;
+  if ((fstat(fd, &st) != 0) || (st.st_size < sizeof(h)) || (read(fd, &h, sizeof(h)) != sizeof(h)) ||
+      memcmp(h.magic, VOCAB_CACHE_MAGIC, sizeof(h.magic))) {
+    printf("ERROR: %s is not a vocabulary cache\n", vocab_cache_file);
+    exit(1);
+  }
+  VocabCacheKey(key);
+  if ((h.bytes != st.st_size) || memcmp(h.key, key, VOCAB_CACHE_KEY)) {
+    close(fd);
+    if (debug_mode > 0) printf("Vocabulary cache %s is out of date, rebuilding it\n", vocab_cache_file);
+    return 0;
+  }
+  base = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    printf("ERROR: cannot map %s\n", vocab_cache_file);
+    exit(1);
+  }
+  free(vocab);
+  vocab = (struct vocab_word *)(base + h.vocab_offset);
+  vocab_size = vocab_max_size = h.vocab_size;
+  FreeStringArena(&vocab_strings);
+  vocab_strings.data = base + h.strings_offset;
+  vocab_strings.size = vocab_strings.capacity = h.strings_bytes;
+  FreeWordHash(&vocab_hash);
+  vocab_hash.slots = (struct hash_slot *)(base + h.hash_offset);
+  vocab_hash.bits = h.hash_bits;
+  vocab_hash.mask = (1LL << h.hash_bits) - 1;
+  vocab_hash.count = h.hash_count;
+  vocab_hash.release = ReleaseMapped;
+  vocab_codes = (struct vocab_code *)(base + h.codes_offset);
+  code_points = (int *)(base + h.points_offset);
+  unigram.entries = (struct alias_entry *)(base + h.unigram_offset);
+  unigram.size = vocab_size;
+  InitAliasJumps(&unigram);
+  vocab_tables = 1;
+  train_words = h.train_words;
+  vocab_words = h.vocab_words;
+  init_words = h.init_words;
+  if (debug_mode > 0) {
+    printf("Vocabulary from the cache %s\n", vocab_cache_file);
+    printf("Vocab size: %lld\n", vocab_size);
+    printf("Words in train file: %lld\n", train_words);
+  }
+  return 1;
+}
+
+// Worker: trains on the run of the coordinator until it is complete
+void TrainWorker() {
+  long a;
+  FILE *fin;
+  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  fin = fmemopen((char *)shared + shared->vocab_offset, shared->vocab_bytes, "rb");
+  ClearVocab();
+  ReadVocabCounts(fin);
+  fclose(fin);
+  SortVocab();
+  if ((vocab_size != shared->vocab_size) || (GetVocabChecksum() != shared->vocab_checksum)) {
+    printf("ERROR: the vocabulary of %s did not load\n", attach_name);
+    exit(1);
+  }
+  train_words = shared->train_words;
+  vocab_words = shared->vocab_words;
+  if (train_encoded_file[0] != 0) LoadEncodedCorpus(); else MapTrainFile();
+  if (file_size != shared->file_size) {
+    printf("ERROR: %s is not the training data of %s\n", (train_encoded_file[0] != 0) ? train_encoded_file : train_file, attach_name);
+    exit(1);
+  }
+  MapSharedWeights();
+  CreateBinaryTree();
+  if (negative > 0) InitUnigramTable();
+  InitChunkSchedule(&schedule, file_size, num_chunks, iter, AlignToSentence, 1, (char *)shared + shared->schedule_offset, 0);
+  worker_id = JoinWorkers(shared->workers, &shared->lock);
+  if (worker_id < 0) {
+    printf("ERROR: %s has %d workers already\n", attach_name, SHARED_MAX_WORKERS);
+    exit(1);
+  }
+  if (debug_mode > 0) printf("Worker %d of %s, training on %s\n", worker_id, attach_name, (train_encoded_file[0] != 0) ? train_encoded_file : train_file);
+  start = clock();
+  trainers_running = num_threads;
+  if (num_readers > 0) TrainPipeline(); else {
+    for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, TrainModelThread, (void *)a);
+    WaitForTrainers();
+    for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+  }
+  FreeWorker(&shared->workers[worker_id], &shared->lock);
+  FreeChunkSchedule(&schedule);
+  free(pt);
+  if (debug_mode > 0) printf("\nWorker %d done\n", worker_id);
+}
+
 void TrainModel() {
   long a, b, c, d;
+  struct timespec t0, t1;
+  char vocab_path[MAX_STRING + 32];
   FILE *fo;
   pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
-  printf("Starting training using file %s\n", train_file);
+  printf("Starting training using file %s\n", (train_encoded_file[0] != 0) ? train_encoded_file : train_file);
+  if (resume) ReadCheckpointHeader();
   starting_alpha = alpha;
-  if (read_vocab_file[0] != 0) ReadVocab(); else LearnVocabFromTrainFile();
-  if (save_vocab_file[0] != 0) SaveVocab();
+  if ((vocab_cache_file[0] == 0) || !ReadVocabCache()) {
+    if (read_vocab_file[0] != 0) ReadVocab(); else LearnVocabFromTrainFile();
+    if (vocab_cache_file[0] != 0) WriteVocabCache();
+  } else if (train_encoded_file[0] == 0) MapTrainFile();
+  if (train_encoded_file[0] != 0) LoadEncodedCorpus();
+  if (resume) {
+    // Which of the counts came from the training data is not in the saved vocabulary
+    train_words = resume_header.train_words;
+    init_words = resume_header.init_words;
+  }
+  if (save_vocab_file[0] != 0) SaveVocab(save_vocab_file);
   if (output_file[0] == 0) return;
+  if ((checkpoint_dir[0] != 0) && !resume) {
+    // The vocabulary goes with the checkpoints, so that -resume gets the same word indices
+    mkdir(checkpoint_dir, 0755);
+    snprintf(vocab_path, sizeof(vocab_path), "%s/vocab", checkpoint_dir);
+    SaveVocab(vocab_path);
+  }
+  // Chunks of 64 KB or more, by default 16 for every thread that reads
+  c = (num_readers > 0) ? num_readers : num_threads;
+  if (c < 1) c = 1;  // A coordinator that leaves all the work to its workers
+  if (num_chunks <= 0) num_chunks = (file_size / (16 * c) >= 65536) ? 16 * c : file_size / 65536 + 1;
+  if (shm_name[0] != 0) CreateSharedRun();
   InitNet();
-  if (negative > 0) InitUnigramTable();
+  if (init_vectors_file[0] != 0) {
+    if (freeze) frozen = (unsigned char *)calloc(vocab_size, 1);
+    LoadVectors(init_vectors_file, syn0, syn0_half, frozen);
+  }
+  if (init_context_file[0] != 0) LoadVectors(init_context_file, syn1neg, syn1neg_half, NULL);
+  if (resume) LoadCheckpoint();
+  if ((negative > 0) && !vocab_tables) InitUnigramTable();
+  if (hot_rows > vocab_size) hot_rows = vocab_size;
+  if (debug_mode > 0) ReportHugePages();
+  InitChunkSchedule(&schedule, file_size, num_chunks, iter, AlignToSentence, 1,
+                    (shared != NULL) ? (char *)shared + shared->schedule_offset : NULL, 1);
+  if (debug_mode > 0) printf("Chunks: %lld per iteration, about %lld KB each\n", num_chunks, file_size / num_chunks / 1024);
   start = clock();
-  for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, TrainModelThread, (void *)a);
-  for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
-  fo = fopen(output_file, "wb");
+  if (resume) {
+    word_count_actual = ResumeChunkSchedule(&schedule, resume_header.chunks_done, resume_header.words_done,
+                                            resume_finished, resume_header.num_finished);
+    if (shared != NULL) shared->word_count = word_count_actual;
+    UpdateProgress(0);
+  }
+  if (shared != NULL) __atomic_store_n(&shared->ready, 1, __ATOMIC_RELEASE);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  trainers_running = num_threads;
+  if (num_readers > 0) TrainPipeline(); else {
+    for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, TrainModelThread, (void *)a);
+    if ((checkpoint_dir[0] != 0) || (shared != NULL)) WaitForTrainers();
+    for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+  }
+  if (shared != NULL) shm_unlink(shm_name);  // Workers that still map it finish on their own
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (numa && (debug_mode > 0)) ReportNuma(t1.tv_sec - t0.tv_sec + (t1.tv_nsec - t0.tv_nsec) * 1e-9);
+  if ((hot_rows > 0) && (debug_mode > 0)) ReportHotRows(t1.tv_sec - t0.tv_sec + (t1.tv_nsec - t0.tv_nsec) * 1e-9);
+  FreeChunkSchedule(&schedule);
+  if (storage != STORAGE_FP32) ExpandHalfStorage();
+  if (save_context_file[0] != 0) SaveVectors(save_context_file, syn1neg);
   if (classes == 0) {
     // Save the word vectors
-    fprintf(fo, "%lld %lld\n", vocab_size, layer1_size);
-    for (a = 0; a < vocab_size; a++) {
-      fprintf(fo, "%s ", GetWordPtrI(a));
-      if (binary) for (b = 0; b < layer1_size; b++) fwrite(&syn0[a * layer1_size + b], sizeof(real), 1, fo);
-      else for (b = 0; b < layer1_size; b++) fprintf(fo, "%lf ", syn0[a * layer1_size + b]);
-      fprintf(fo, "\n");
-    }
+    SaveVectors(output_file, syn0);
   } else {
+    fo = fopen(output_file, "wb");
     // Run K-means on the word vectors
     int clcn = classes, iter = 10, closeid;
     int *centcn = (int *)malloc(classes * sizeof(int));
@@ -804,12 +2367,22 @@ void TrainModel() {
     }
     // Save the K-means classes
     for (a = 0; a < vocab_size; a++) fprintf(fo, "%s %d\n", GetWordPtrI(a), cl[a]);
+    fclose(fo);
 
     free(centcn);
     free(cent);
     free(cl);
   }
-  fclose(fo);
+}
+
+// A number of bytes with an optional K, M or G suffix
+long long ParseSize(const char *s) {
+  char *end;
+  long long n = strtoll(s, &end, 10);
+  if ((*end == 'k') || (*end == 'K')) n <<= 10;
+  if ((*end == 'm') || (*end == 'M')) n <<= 20;
+  if ((*end == 'g') || (*end == 'G')) n <<= 30;
+  return n;
 }
 
 int ArgPos(char *str, int argc, char **argv) {
@@ -835,7 +2408,7 @@ int main(int argc, char **argv) {
     printf("\t-output <file>\n");
     printf("\t\tUse <file> to save the resulting word vectors / word clusters\n");
     printf("\t-size <int>\n");
-    printf("\t\tSet size of word vectors; default is 100\n");
+    printf("\t\tSet size of word vectors; default is 100. 100, 128, 200, 256, 300 and 512 use specialized code\n");
     printf("\t-window <int>\n");
     printf("\t\tSet max skip length between words; default is 5\n");
     printf("\t-sample <float>\n");
@@ -845,12 +2418,31 @@ int main(int argc, char **argv) {
     printf("\t\tUse Hierarchical Softmax; default is 0 (not used)\n");
     printf("\t-negative <int>\n");
     printf("\t\tNumber of negative examples; default is 5, common values are 3 - 10 (0 = not used)\n");
+    printf("\t-batch-neg <int>\n");
+    printf("\t\tSkip-gram only: share one set of negatives across the window of each word and update as small\n");
+    printf("\t\tmatrix products; default is 0 (off)\n");
+    printf("\t-prefetch <int>\n");
+    printf("\t\tPrefetch the weight rows <int> positions (and negative sets) ahead; default is 2 (0 = off)\n");
+    printf("\t-hot-rows <int>\n");
+    printf("\t\tNegative sampling: every thread updates its own copy of the output rows of the <int> most frequent\n");
+    printf("\t\twords and merges its changes into the shared ones; default is 0 (off)\n");
+    printf("\t-hot-sync <int>\n");
+    printf("\t\tMerge the -hot-rows copies every <int> words a thread trains on; default is 1000\n");
     printf("\t-threads <int>\n");
     printf("\t\tUse <int> threads (default 12)\n");
+    printf("\t-readers <int>\n");
+    printf("\t\tUse <int> threads only for reading and subsampling, feeding the -threads trainers through a queue;\n");
+    printf("\t\tdefault is 0 (every thread reads its own part of the data)\n");
+    printf("\t-chunks <int>\n");
+    printf("\t\tSplit the training data into <int> chunks, taken by the threads as they become free, in a new\n");
+    printf("\t\trandom order every iteration; default is 16 per thread, at least 64 KB each\n");
     printf("\t-iter <int>\n");
     printf("\t\tRun more training iterations (default 5)\n");
     printf("\t-min-count <int>\n");
     printf("\t\tThis will discard words that appear less than <int> times; default is 5\n");
+    printf("\t-vocab-memory <size>\n");
+    printf("\t\tCount the vocabulary in one pass in <size> bytes (suffix K, M or G), keeping the most frequent\n");
+    printf("\t\twords with approximate counts; default is 0 (count exactly, pruning rare words if it gets too large)\n");
     printf("\t-alpha <float>\n");
     printf("\t\tSet the starting learning rate; default is 0.025 for skip-gram and 0.05 for CBOW\n");
     printf("\t-classes <int>\n");
@@ -863,6 +2455,49 @@ int main(int argc, char **argv) {
     printf("\t\tThe vocabulary will be saved to <file>\n");
     printf("\t-read-vocab <file>\n");
     printf("\t\tThe vocabulary will be read from <file>, not constructed from the training data\n");
+    printf("\t-vocab-cache <file>\n");
+    printf("\t\tMap the vocabulary, its Huffman codes and unigram table from <file>, or build them and write <file>\n");
+    printf("\t\tif it was made from other files or options\n");
+    printf("\t-train-encoded <file>\n");
+    printf("\t\tUse data from <file> written by w2v-encode instead of -train; requires the -read-vocab it was encoded with\n");
+    printf("\t-kernels <name>\n");
+    printf("\t\tUse the avx512, avx2, sse, neon or scalar vector kernels; default is the best this CPU supports\n");
+    printf("\t-storage <name>\n");
+    printf("\t\tKeep the input and negative sampling weights as fp32 (default), bf16 or fp16; output is always fp32\n");
+    printf("\t-stochastic-round <int>\n");
+    printf("\t\tRound bf16 weight updates stochastically instead of to nearest; default is 0 (off)\n");
+    printf("\t-huge-pages <kind>\n");
+    printf("\t\tBack the weights and lookup tables with huge pages: off, thp (transparent, the default), 2m or 1g\n");
+    printf("\t\t(explicit, from the reserved pool; fall back to the next smaller kind when it runs out)\n");
+    printf("\t-numa <int>\n");
+    printf("\t\tInterleave the weights over all NUMA nodes and pin threads to cores (1); default is 0 (off)\n");
+    printf("\t-init-vectors <file>\n");
+    printf("\t\tStart from the word vectors of an earlier run, written with -output (text or binary)\n");
+    printf("\t-init-context <file>\n");
+    printf("\t\tStart from the negative sampling weights of an earlier run, written with -save-context\n");
+    printf("\t-init-vocab <file>\n");
+    printf("\t\tAdd the word counts of an earlier run, written with -save-vocab, to those of the training data\n");
+    printf("\t-freeze <int>\n");
+    printf("\t\tKeep the vectors read with -init-vectors fixed and only train the other words (1); default is 0 (off)\n");
+    printf("\t-save-context <file>\n");
+    printf("\t\tAlso save the negative sampling weights to <file>, in the format of the word vectors\n");
+    printf("\t-shm <name>\n");
+    printf("\t\tKeep the weights and the work queue in the POSIX shared memory segment <name> (such as /w2v), so that\n");
+    printf("\t\tprocesses started with -attach <name> train the model too; this one writes the result\n");
+    printf("\t-attach <name>\n");
+    printf("\t\tTrain as a worker of the run started with -shm <name>, with its data and settings; of the other options\n");
+    printf("\t\tonly -threads, -readers, -train (the path of the same data), -kernels, -prefetch, -numa, -huge-pages\n");
+    printf("\t\tand -debug apply\n");
+    printf("\t-worker-timeout <int>\n");
+    printf("\t\tSeconds without a sign of life after which a process of a shared run counts as dead and its chunks\n");
+    printf("\t\tare handed out again; default is 30\n");
+    printf("\t-checkpoint <dir>\n");
+    printf("\t\tWrite the weights and the training progress to <dir> while training, so that it can be resumed\n");
+    printf("\t-checkpoint-every <float>\n");
+    printf("\t\tMinutes between checkpoints; default is 60\n");
+    printf("\t-resume <int>\n");
+    printf("\t\tContinue from the checkpoint in the -checkpoint <dir>, with its vocabulary, iterations and learning rate (1);\n");
+    printf("\t\tdefault is 0 (start over)\n");
     printf("\t-cbow <int>\n");
     printf("\t\tUse the continuous bag of words model; default is 1 (use 0 for skip-gram model)\n");
     printf("\nExamples:\n");
@@ -872,14 +2507,43 @@ int main(int argc, char **argv) {
   output_file[0] = 0;
   save_vocab_file[0] = 0;
   read_vocab_file[0] = 0;
+  train_encoded_file[0] = 0;
+  kernel_name[0] = 0;
+  storage_name[0] = 0;
+  huge_pages_name[0] = 0;
+  checkpoint_dir[0] = 0;
+  shm_name[0] = 0;
+  attach_name[0] = 0;
+  init_vectors_file[0] = 0;
+  init_context_file[0] = 0;
+  init_vocab_file[0] = 0;
+  save_context_file[0] = 0;
 #ifndef CONST_LAYER1
   if ((i = ArgPos((char *)"-size", argc, argv)) > 0) layer1_size = atoi(argv[i + 1]);
 #endif
   if ((i = ArgPos((char *)"-train", argc, argv)) > 0) strcpy(train_file, argv[i + 1]);
   if ((i = ArgPos((char *)"-save-vocab", argc, argv)) > 0) strcpy(save_vocab_file, argv[i + 1]);
   if ((i = ArgPos((char *)"-read-vocab", argc, argv)) > 0) strcpy(read_vocab_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-vocab-cache", argc, argv)) > 0) strcpy(vocab_cache_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-train-encoded", argc, argv)) > 0) strcpy(train_encoded_file, argv[i + 1]);
   if ((i = ArgPos((char *)"-debug", argc, argv)) > 0) debug_mode = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-binary", argc, argv)) > 0) binary = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-kernels", argc, argv)) > 0) strcpy(kernel_name, argv[i + 1]);
+  if ((i = ArgPos((char *)"-storage", argc, argv)) > 0) strcpy(storage_name, argv[i + 1]);
+  if ((i = ArgPos((char *)"-stochastic-round", argc, argv)) > 0) stochastic_round = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-numa", argc, argv)) > 0) numa = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-huge-pages", argc, argv)) > 0) strcpy(huge_pages_name, argv[i + 1]);
+  if ((i = ArgPos((char *)"-init-vectors", argc, argv)) > 0) strcpy(init_vectors_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-init-context", argc, argv)) > 0) strcpy(init_context_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-init-vocab", argc, argv)) > 0) strcpy(init_vocab_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-freeze", argc, argv)) > 0) freeze = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-save-context", argc, argv)) > 0) strcpy(save_context_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-shm", argc, argv)) > 0) strcpy(shm_name, argv[i + 1]);
+  if ((i = ArgPos((char *)"-attach", argc, argv)) > 0) strcpy(attach_name, argv[i + 1]);
+  if ((i = ArgPos((char *)"-worker-timeout", argc, argv)) > 0) worker_timeout = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-checkpoint", argc, argv)) > 0) strcpy(checkpoint_dir, argv[i + 1]);
+  if ((i = ArgPos((char *)"-checkpoint-every", argc, argv)) > 0) checkpoint_every = atof(argv[i + 1]);
+  if ((i = ArgPos((char *)"-resume", argc, argv)) > 0) resume = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-cbow", argc, argv)) > 0) cbow = atoi(argv[i + 1]);
   if (cbow) alpha = 0.05;
   if ((i = ArgPos((char *)"-alpha", argc, argv)) > 0) alpha = atof(argv[i + 1]);
@@ -888,20 +2552,90 @@ int main(int argc, char **argv) {
   if ((i = ArgPos((char *)"-sample", argc, argv)) > 0) sample = atof(argv[i + 1]);
   if ((i = ArgPos((char *)"-hs", argc, argv)) > 0) hs = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-negative", argc, argv)) > 0) negative = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-batch-neg", argc, argv)) > 0) batch_neg = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-prefetch", argc, argv)) > 0) prefetch = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-hot-rows", argc, argv)) > 0) hot_rows = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-hot-sync", argc, argv)) > 0) hot_sync = atoll(argv[i + 1]);
   if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) num_threads = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-chunks", argc, argv)) > 0) num_chunks = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-readers", argc, argv)) > 0) num_readers = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-iter", argc, argv)) > 0) iter = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-min-count", argc, argv)) > 0) min_count = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-vocab-memory", argc, argv)) > 0) vocab_memory = ParseSize(argv[i + 1]);
   if ((i = ArgPos((char *)"-classes", argc, argv)) > 0) classes = atoi(argv[i + 1]);
+  if (attach_name[0] != 0) AttachSharedRun();
 
+  const struct kernel_set *ks = SelectKernels(kernel_name);
+  if (ks == NULL) {
+    printf("ERROR: kernels %s are unknown or not supported by this CPU\n", kernel_name);
+    return 1;
+  }
+  ks = SizedKernels(ks, layer1_size);
+  DoMAC = ks->mac;
+  DoAdd = ks->add;
+  DoMAC1 = ks->mac1;
+  DoUpdate = ks->update;
+  DoSigmoidGrad = ks->sigmoid_grad;
+  SelectTrainer();
+  if (debug_mode > 0) printf("Using %s kernels%s\n", ks->name, ks->size ? " specialized for this -size" : "");
+  if (batch_neg && (cbow || hs || (negative <= 0))) {
+    printf("ERROR: -batch-neg requires skip-gram with negative sampling (-cbow 0 -hs 0 -negative > 0)\n");
+    return 1;
+  }
+  if ((hot_rows > 0) && (negative <= 0)) {
+    printf("ERROR: -hot-rows requires negative sampling (-negative > 0)\n");
+    return 1;
+  }
+  if (resume && (checkpoint_dir[0] == 0)) {
+    printf("ERROR: -resume requires -checkpoint\n");
+    return 1;
+  }
+  if (((init_context_file[0] != 0) || (save_context_file[0] != 0)) && (negative <= 0)) {
+    printf("ERROR: -init-context and -save-context require negative sampling (-negative > 0)\n");
+    return 1;
+  }
+  if (freeze && (init_vectors_file[0] == 0)) {
+    printf("ERROR: -freeze requires -init-vectors\n");
+    return 1;
+  }
+  if (resume) {
+    if (snprintf(read_vocab_file, MAX_STRING, "%s/vocab", checkpoint_dir) >= MAX_STRING) {
+      printf("ERROR: the -checkpoint directory %s is too long\n", checkpoint_dir);
+      return 1;
+    }
+    init_vocab_file[0] = 0;  // Already merged into the vocabulary of the checkpoint
+  }
+  if (freeze && (shm_name[0] != 0)) {
+    printf("ERROR: -freeze is not supported with -shm\n");
+    return 1;
+  }
+  if ((train_encoded_file[0] != 0) && (read_vocab_file[0] == 0) && (attach_name[0] == 0)) {
+    printf("ERROR: -train-encoded requires -read-vocab\n");
+    return 1;
+  }
+  if ((storage_name[0] == 0) || !strcmp(storage_name, "fp32")) storage = STORAGE_FP32;
+  else if (!strcmp(storage_name, "bf16")) storage = STORAGE_BF16;
+  else if (!strcmp(storage_name, "fp16") && HALF_HAS_FP16) storage = STORAGE_FP16;
+  else {
+    printf("ERROR: unknown or unsupported -storage %s\n", storage_name);
+    return 1;
+  }
+  if (numa) {
+    ReadNumaTopology(&topology);
+    if (debug_mode > 0) printf("NUMA: %d nodes, %d CPUs\n", topology.num_nodes, topology.num_cpus);
+  }
   vocab = (struct vocab_word *)calloc(vocab_max_size, sizeof(struct vocab_word));
-  vocab_hash = (int *)calloc(vocab_hash_size, sizeof(int));
-
-  expTable = (real *)malloc((EXP_TABLE_SIZE + 1) * sizeof(real));
-  for (i = 0; i < EXP_TABLE_SIZE; i++) {
-    expTable[i] = exp((i / (real)EXP_TABLE_SIZE * 1 - 0) * MAX_EXP); // Precompute the exp() table
-    expTable[i] = (expTable[i] / (expTable[i] + 1)) - 0.5;                   // Precompute f(x) = x / (x + 1)
+  if ((huge_pages_name[0] == 0) || !strcmp(huge_pages_name, "thp")) huge_pages = HUGE_THP;
+  else if (!strcmp(huge_pages_name, "off")) huge_pages = HUGE_OFF;
+  else if (!strcmp(huge_pages_name, "2m")) huge_pages = HUGE_2M;
+  else if (!strcmp(huge_pages_name, "1g")) huge_pages = HUGE_1G;
+  else {
+    printf("ERROR: unknown -huge-pages %s\n", huge_pages_name);
+    return 1;
   }
+  InitWordHash(&vocab_hash, 0, AllocVocabHash, FreeHuge);
+  InitStringArena(&vocab_strings, 0);
 
-  TrainModel();
+  if (attach_name[0] != 0) TrainWorker(); else TrainModel();
   return 0;
 }